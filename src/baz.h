@@ -58,23 +58,35 @@ _Static_assert(sizeof(i64) == 8, "i64 should be 8 byte");
 typedef i64 isize;
 typedef u64 usize;
 
+typedef unsigned __int128 u128;
+
 #define UINT8_MAX 255
 #define UINT16_MAX 65535
 #define UINT32_MAX 4294967295
-#define UINT64_MAX 18446744073709551615L
+#define UINT64_MAX 18446744073709551615UL
+#define INT32_MAX 2147483647
+#define INT32_MIN (-INT32_MAX - 1)
 
 ///////////////////////////////////////////////////////////////////////////////
 // Syscalls
 
 // From glibc
+#define STDIN 0
 #define STDOUT 1
 #define STDERR 2
 #define O_RDONLY 0
+#define O_WRONLY 1
+#define O_CREAT 0x40
+#define O_TRUNC 0x200
 #define SEEK_END 2
 #define PROT_READ 0x1
 #define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
 #define MAP_PRIVATE 0x02
 #define MAP_ANONYMOUS 0x20
+#define CLOCK_MONOTONIC 1
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
 
 isize sys_write(i32 fd, const void *buf, usize size) {
   register i64 rax __asm__("rax") = 1;
@@ -88,6 +100,18 @@ isize sys_write(i32 fd, const void *buf, usize size) {
   return rax;
 }
 
+isize sys_read(i32 fd, void *buf, usize size) {
+  register i64 rax __asm__("rax") = 0;
+  register i32 rdi __asm__("rdi") = fd;
+  register void *rsi __asm__("rsi") = buf;
+  register usize rdx __asm__("rdx") = size;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi), "r"(rsi), "r"(rdx)
+                       : "rcx", "r11", "memory");
+  return rax;
+}
+
 isize sys_lseek(i32 fd, isize offset, usize origin) {
   register i64 rax __asm__("rax") = 8;
   register i32 rdi __asm__("rdi") = fd;
@@ -112,6 +136,32 @@ i32 sys_open(const char *filename, i32 flags, i32 mode) {
   return (i32)rax;
 }
 
+i32 sys_close(i32 fd) {
+  register i64 rax __asm__("rax") = 3;
+  register i32 rdi __asm__("rdi") = fd;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi)
+                       : "rcx", "r11", "memory");
+  return (i32)rax;
+}
+
+i32 sys_unlink(const char *filename) {
+  register i64 rax __asm__("rax") = 87;
+  register const char *rdi __asm__("rdi") = filename;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi)
+                       : "rcx", "r11", "memory");
+  return (i32)rax;
+}
+
+i32 sys_getpid(void) {
+  register i64 rax __asm__("rax") = 39;
+  __asm__ __volatile__("syscall" : "+r"(rax) : : "rcx", "r11", "memory");
+  return (i32)rax;
+}
+
 void *sys_mmap(void *addr, usize length, i32 prot, i32 flags, i32 fd,
                isize offset) {
   register i64 rax __asm__("rax") = 9;
@@ -129,7 +179,73 @@ void *sys_mmap(void *addr, usize length, i32 prot, i32 flags, i32 fd,
   return (void *)rax;
 }
 
+i32 sys_mprotect(void *addr, usize length, i32 prot) {
+  register i64 rax __asm__("rax") = 10;
+  register void *rdi __asm__("rdi") = addr;
+  register usize rsi __asm__("rsi") = length;
+  register i32 rdx __asm__("rdx") = prot;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi), "r"(rsi), "r"(rdx)
+                       : "rcx", "r11", "memory");
+  return (i32)rax;
+}
+
+typedef struct {
+  i64 tv_sec;
+  i64 tv_nsec;
+} Timespec;
+
+i32 sys_clock_gettime(i32 clock, Timespec *ts) {
+  register i64 rax __asm__("rax") = 228;
+  register i32 rdi __asm__("rdi") = clock;
+  register Timespec *rsi __asm__("rsi") = ts;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi), "r"(rsi)
+                       : "rcx", "r11", "memory");
+  return (i32)rax;
+}
+
+i32 sys_futex(i32 *uaddr, i32 op, i32 val, const Timespec *timeout) {
+  register i64 rax __asm__("rax") = 202;
+  register i32 *rdi __asm__("rdi") = uaddr;
+  register i32 rsi __asm__("rsi") = op;
+  register i32 rdx __asm__("rdx") = val;
+  register const Timespec *r10 __asm__("r10") = timeout;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi), "r"(rsi), "r"(rdx), "r"(r10)
+                       : "rcx", "r11", "memory");
+  return (i32)rax;
+}
+
+// Returns the size of the mask written, in bytes
+i32 sys_sched_getaffinity(i32 pid, usize len, u64 *mask) {
+  register i64 rax __asm__("rax") = 204;
+  register i32 rdi __asm__("rdi") = pid;
+  register usize rsi __asm__("rsi") = len;
+  register u64 *rdx __asm__("rdx") = mask;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi), "r"(rsi), "r"(rdx)
+                       : "rcx", "r11", "memory");
+  return (i32)rax;
+}
+
+// exit_group: takes down every thread, so a panic in a worker ends the process
 void sys_exit(i32 exit_status) {
+  register i64 rax __asm__("rax") = 231;
+  register i32 rdi __asm__("rdi") = exit_status;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi)
+                       : "rcx", "r11", "memory");
+  __builtin_unreachable();
+}
+
+// Ends only the calling thread
+void sys_exit_thread(i32 exit_status) {
   register i64 rax __asm__("rax") = 60;
   register i32 rdi __asm__("rdi") = exit_status;
   __asm__ __volatile__("syscall"
@@ -139,16 +255,189 @@ void sys_exit(i32 exit_status) {
   __builtin_unreachable();
 }
 
+// Monotonic clock, for timings
+private
+u64 now_ns(void) {
+  Timespec ts;
+  sys_clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000ul + (u64)ts.tv_nsec;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Entry point
 
 int main(void);
 
-__attribute__((force_align_arg_pointer)) void _start() {
+// Command line arguments (args[0] is the program name)
+private usize args_len = 0;
+private const char **args = NULL;
+
+__attribute__((used)) void _start_c(const usize *sp) {
+  args_len = sp[0];
+  args = (const char **)&sp[1];
+
   int ret = main();
   sys_exit(ret);
 }
 
+// The kernel leaves argc at the top of the stack, followed by argv. Hand it
+// over to _start_c with the stack aligned as a normal call would.
+__asm__(".globl _start\n"
+        "_start:\n"
+        "  mov %rsp, %rdi\n"
+        "  and $-16, %rsp\n"
+        "  call _start_c\n");
+
+////////////////////////////////////////////////////////////////////////////////
+// SIMD
+
+// No immintrin.h (-nostdinc), so we use GCC vector extensions and the
+// __builtin_ia32_* intrinsics directly. Everything assumes AVX2 (-march).
+typedef u8 u8x32 __attribute__((vector_size(32)));
+typedef i8 i8x32 __attribute__((vector_size(32)));
+typedef u16 u16x16 __attribute__((vector_size(32)));
+typedef u32 u32x8 __attribute__((vector_size(32)));
+typedef i32 i32x8 __attribute__((vector_size(32)));
+typedef u64 u64x4 __attribute__((vector_size(32)));
+typedef float f32x8 __attribute__((vector_size(32)));
+// pclmulqdq wants long long lanes, which are distinct from our (long) i64
+typedef long long i64x2 __attribute__((vector_size(16)));
+
+// Unaligned variants for loading straight out of a Span
+typedef u8x32 u8x32_unaligned __attribute__((aligned(1), may_alias));
+typedef u32x8 u32x8_unaligned __attribute__((aligned(1), may_alias));
+
+private
+inline u8x32 u8x32_load(const u8 *p) { return *(const u8x32_unaligned *)p; }
+
+private
+inline void u8x32_store(u8 *p, u8x32 x) { *(u8x32_unaligned *)p = x; }
+
+private
+inline u32x8 u32x8_load(const u32 *p) { return *(const u32x8_unaligned *)p; }
+
+private
+inline void u32x8_store(u32 *p, u32x8 x) { *(u32x8_unaligned *)p = x; }
+
+private
+inline u8x32 u8x32_splat(u8 x) {
+  u8x32 ret = {x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x,
+               x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x};
+  return ret;
+}
+
+private
+inline u32x8 u32x8_splat(u32 x) {
+  u32x8 ret = {x, x, x, x, x, x, x, x};
+  return ret;
+}
+
+private
+inline i32x8 i32x8_splat(i32 x) {
+  i32x8 ret = {x, x, x, x, x, x, x, x};
+  return ret;
+}
+
+// Lanes of a where mask is all ones, of b where it is zero
+private
+inline i32x8 i32x8_select(i32x8 mask, i32x8 a, i32x8 b) {
+  return (mask & a) | (~mask & b);
+}
+
+// Smallest lane, in 3 rounds of swapping halves
+private
+inline i32 i32x8_hmin(i32x8 x) {
+  x = __builtin_ia32_pminsd256(
+      x, __builtin_shuffle(x, (i32x8){4, 5, 6, 7, 0, 1, 2, 3}));
+  x = __builtin_ia32_pminsd256(
+      x, __builtin_shuffle(x, (i32x8){2, 3, 0, 1, 6, 7, 4, 5}));
+  x = __builtin_ia32_pminsd256(
+      x, __builtin_shuffle(x, (i32x8){1, 0, 3, 2, 5, 4, 7, 6}));
+  return x[0];
+}
+
+// One bit per byte lane (top bit of each lane)
+private
+inline u32 u8x32_movemask(u8x32 x) {
+  return (u32)__builtin_ia32_pmovmskb256((i8x32)x);
+}
+
+// One bit per u32 lane (top bit of each lane)
+private
+inline u32 u32x8_movemask(u32x8 x) {
+  return (u32)__builtin_ia32_movmskps256((f32x8)x);
+}
+
+// 64 byte lanes (two vectors at p) as a bitmask
+private
+inline u64 u8x64_eq_mask(const u8 *p, u8 c) {
+  u64 lo = u8x32_movemask((u8x32)(u8x32_load(p) == u8x32_splat(c)));
+  u64 hi = u8x32_movemask((u8x32)(u8x32_load(p + 32) == u8x32_splat(c)));
+  return lo | (hi << 32);
+}
+
+// Bit i is set when a[i] == b[i], for 64 bytes
+private
+inline u64 u8x64_eq_bytes_mask(const u8 *a, const u8 *b) {
+  u64 lo = u8x32_movemask((u8x32)(u8x32_load(a) == u8x32_load(b)));
+  u64 hi = u8x32_movemask((u8x32)(u8x32_load(a + 32) == u8x32_load(b + 32)));
+  return lo | (hi << 32);
+}
+
+// Bit i of the result is the XOR of bits 0..=i of x. Carry-less multiply by
+// all ones does it in one instruction.
+private
+inline u64 u64_prefix_xor(u64 x) {
+  i64x2 a = {(long long)x, 0};
+  i64x2 ones = {-1, 0};
+  return (u64)__builtin_ia32_pclmulqdq128(a, ones, 0)[0];
+}
+
+typedef u64x4 u64x4_unaligned __attribute__((aligned(1), may_alias));
+
+// Transpose a 64x64 bit matrix in place: bit c of row r ends up as bit r of
+// row c. Recursive block swaps, 6 rounds of 32 word pairs. The rounds pairing
+// rows 4 or more apart swap 4 consecutive rows at a time.
+private
+void bit_transpose64(u64 m[64]) {
+  u64 mask = 0x00000000FFFFFFFFul;
+  usize j = 32;
+
+  for (; j >= 4; j >>= 1, mask ^= mask << j) {
+    u64x4 vmask = {mask, mask, mask, mask};
+
+    for (usize base = 0; base < 64; base += 2 * j) {
+      for (usize k = base; k < base + j; k += 4) {
+        u64x4 a = *(u64x4_unaligned *)&m[k];
+        u64x4 b = *(u64x4_unaligned *)&m[k + j];
+        u64x4 t = ((a >> j) ^ b) & vmask;
+        *(u64x4_unaligned *)&m[k] = a ^ (t << j);
+        *(u64x4_unaligned *)&m[k + j] = b ^ t;
+      }
+    }
+  }
+
+  for (; j != 0; j >>= 1, mask ^= mask << j) {
+    for (usize k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+      u64 t = ((m[k] >> j) ^ m[k | j]) & mask;
+      m[k] ^= t << j;
+      m[k | j] ^= t;
+    }
+  }
+}
+
+private
+inline u32x8 u32x8_max(u32x8 a, u32x8 b) {
+  u32x8 gt = (u32x8)(a > b);
+  return (a & gt) | (b & ~gt);
+}
+
+private
+inline u32x8 u32x8_min(u32x8 a, u32x8 b) {
+  u32x8 lt = (u32x8)(a < b);
+  return (a & lt) | (b & ~lt);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Mem utils
 
@@ -166,6 +455,25 @@ extern void *memcpy(void *__restrict dst, const void *__restrict src,
   return dst;
 }
 
+// Handles overlapping ranges
+private
+void *memmove(void *dst, const void *src, usize bytes) {
+  u8 *dst_bytes = (u8 *)dst;
+  const u8 *src_bytes = (const u8 *)src;
+
+  if (dst_bytes < src_bytes) {
+    for (usize i = 0; i < bytes; i++) {
+      dst_bytes[i] = src_bytes[i];
+    }
+  } else {
+    for (usize i = bytes; i > 0; i--) {
+      dst_bytes[i - 1] = src_bytes[i - 1];
+    }
+  }
+
+  return dst;
+}
+
 // Needed by C compiler for zero-initialisation
 extern void *memset(void *s, int c, usize bytes) {
   u8 *s_byte = (u8 *)s;
@@ -216,12 +524,21 @@ int memcmp(const void *a, const void *b, usize bytes) {
 private
 void *memchr(const void *s, int c, usize bytes) {
   const u8 *s8 = (const u8 *)s;
-  u8 c8 = (u8)c;
+  u8x32 needle = u8x32_splat((u8)c);
 
-  // naive impl
-  for (usize i = 0; i < bytes; i++) {
-    if (s8[i] == c8) {
-      return (void *)((usize)s + i);
+  // 32 bytes at a time, then the tail one by one: never reads outside of
+  // [s, s + bytes)
+  usize i = 0;
+  for (; i + 32 <= bytes; i += 32) {
+    u32 bits = u8x32_movemask((u8x32)(u8x32_load(&s8[i]) == needle));
+    if (bits != 0) {
+      return (void *)&s8[i + (usize)__builtin_ctz(bits)];
+    }
+  }
+
+  for (; i < bytes; i++) {
+    if (s8[i] == (u8)c) {
+      return (void *)&s8[i];
     }
   }
 
@@ -241,6 +558,110 @@ usize strlen(const char *str) {
   return (usize)(ptr - str);
 }
 
+private
+bool streq(const char *a, const char *b) {
+  usize len = strlen(a);
+  return len == strlen(b) && memcmp(a, b, len) == 0;
+}
+
+// Was `arg` passed on the command line
+private
+bool args_has(const char *arg) {
+  for (usize i = 1; i < args_len; i++) {
+    if (streq(args[i], arg)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Every day takes `dayNN [file] [mode [arg]...] [--flag [value]]...`: the input
+// path comes first ("-" is stdin for the days that stream), then one of the
+// day's modes with its arguments, then flags. Anything else panics.
+typedef struct {
+  const char *name;
+  bool value; // takes the next argument
+} CliFlag;
+
+typedef struct {
+  const char *path; // NULL when not given
+  const char *mode; // NULL when not given
+  const char **mode_args;
+  usize mode_args_len;
+  usize flags; // index of the first flag in args
+} Cli;
+
+private
+bool Cli_is_flag(const char *arg) { return arg[0] == '-' && arg[1] == '-'; }
+
+private
+bool Cli_is_mode(const char *arg, const char *const *modes, usize modes_len) {
+  for (usize i = 0; i < modes_len; i++) {
+    if (streq(arg, modes[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+private
+Cli Cli_parse(const char *const *modes, usize modes_len, const CliFlag *flags,
+              usize flags_len) {
+  Cli cli = {0};
+  usize i = 1;
+  if (i < args_len && !Cli_is_flag(args[i]) &&
+      !Cli_is_mode(args[i], modes, modes_len)) {
+    cli.path = args[i++];
+  }
+
+  if (i < args_len && Cli_is_mode(args[i], modes, modes_len)) {
+    cli.mode = args[i++];
+    cli.mode_args = &args[i];
+    while (i < args_len && !Cli_is_flag(args[i])) {
+      cli.mode_args_len++;
+      i++;
+    }
+  }
+
+  cli.flags = i;
+  while (i < args_len) {
+    usize f = 0;
+    while (f < flags_len && !streq(args[i], flags[f].name)) {
+      f++;
+    }
+    if (f == flags_len) {
+      panic("Unexpected argument\n");
+    }
+    i += flags[f].value ? 2 : 1;
+    if (i > args_len) {
+      panic("Missing flag value\n");
+    }
+  }
+
+  return cli;
+}
+
+// The value after flag `name`, NULL when the flag is not given
+private
+const char *Cli_value(const Cli *cli, const char *name) {
+  for (usize i = cli->flags; i + 1 < args_len; i++) {
+    if (streq(args[i], name)) {
+      return args[i + 1];
+    }
+  }
+  return NULL;
+}
+
+private
+bool Cli_flag(const Cli *cli, const char *name) {
+  for (usize i = cli->flags; i < args_len; i++) {
+    if (streq(args[i], name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Printing/Parsing
 
@@ -312,6 +733,32 @@ usize fmt_u64(u8 *buf, usize buf_len, u64 x, u8 base) {
   return i;
 }
 
+private
+usize fmt_u128(u8 *buf, usize buf_len, u128 x, u8 base) {
+  if (x <= UINT64_MAX) {
+    return fmt_u64(buf, buf_len, (u64)x, base);
+  }
+
+  // write in reverse (we don't know how many bytes it will be)
+  usize i = 0;
+  while (x > 0) {
+    assert(i < buf_len); // crash otherwise
+
+    buf[i] = to_digit((u64)(x % base), base);
+    x /= base;
+    i++;
+  }
+
+  // reverse
+  for (usize j = 0; j < i / 2; j++) {
+    u8 t = buf[j];
+    buf[j] = buf[i - 1 - j];
+    buf[i - 1 - j] = t;
+  }
+
+  return i;
+}
+
 private
 usize fmt_i64(u8 *buf, usize buf_len, i64 x, u8 base) {
   if (x < 0) {
@@ -387,6 +834,136 @@ void putu64(u64 x) {
   sys_write(STDOUT, buf, len);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Threads
+
+#define CLONE_VM 0x100
+#define CLONE_FS 0x200
+#define CLONE_FILES 0x400
+#define CLONE_SIGHAND 0x800
+#define CLONE_THREAD 0x10000
+#define CLONE_SYSVSEM 0x40000
+#define CLONE_CHILD_CLEARTID 0x200000
+
+#define THREAD_STACK_SIZE (4 * 1024 * 1024)
+
+typedef struct {
+  void (*fn)(void *);
+  void *arg;
+  u8 *stack; // THREAD_STACK_SIZE bytes, reused by every spawn
+  i32 tid;   // Nonzero while running, the kernel clears it on exit
+} Thread;
+
+// clone(flags, stack, NULL, tid, 0). The child starts on the new stack with
+// the Thread and the function to run pushed on it, so it never returns into
+// the parent's frames.
+i64 thread_clone(u64 flags, void *stack, i32 *tid);
+__asm__(".globl thread_clone\n"
+        "thread_clone:\n"
+        "  mov %rdx, %r10\n"
+        "  xor %edx, %edx\n"
+        "  xor %r8d, %r8d\n"
+        "  mov $56, %eax\n"
+        "  syscall\n"
+        "  test %rax, %rax\n"
+        "  jnz 1f\n"
+        "  pop %rdi\n"
+        "  pop %rax\n"
+        "  call *%rax\n"
+        "  ud2\n"
+        "1:\n"
+        "  ret\n");
+
+__attribute__((used)) static void thread_entry(Thread *t) {
+  t->fn(t->arg);
+  sys_exit_thread(0);
+}
+
+private
+Thread Thread_mk(void) {
+  Thread t = {
+      .stack = (u8 *)calloc(THREAD_STACK_SIZE, 1),
+  };
+  return t;
+}
+
+// Runs fn(arg) on a new thread, the Thread must stay in place until joined
+private
+void Thread_spawn(Thread *t, void (*fn)(void *), void *arg) {
+  t->fn = fn;
+  t->arg = arg;
+
+  // Set before the clone: the thread may be done before clone returns
+  t->tid = -1;
+
+  usize *top = (usize *)(t->stack + THREAD_STACK_SIZE);
+  top[-2] = (usize)t;
+  top[-1] = (usize)thread_entry;
+
+  u64 flags = CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND |
+              CLONE_THREAD | CLONE_SYSVSEM | CLONE_CHILD_CLEARTID;
+  if (thread_clone(flags, &top[-2], &t->tid) < 0) {
+    panic("clone failed\n");
+  }
+}
+
+private
+void Thread_join(Thread *t) {
+  i32 tid = __atomic_load_n(&t->tid, __ATOMIC_ACQUIRE);
+  while (tid != 0) {
+    sys_futex(&t->tid, FUTEX_WAIT, tid, NULL);
+    tid = __atomic_load_n(&t->tid, __ATOMIC_ACQUIRE);
+  }
+}
+
+// Reusable barrier for a fixed number of threads. The last one to arrive
+// starts the next generation and wakes the others.
+typedef struct {
+  u32 count;
+  u32 arrived;
+  i32 generation;
+} Barrier;
+
+private
+Barrier Barrier_mk(u32 count) {
+  assert(count > 0);
+  Barrier b = {
+      .count = count,
+  };
+  return b;
+}
+
+private
+void Barrier_wait(Barrier *b) {
+  i32 gen = __atomic_load_n(&b->generation, __ATOMIC_ACQUIRE);
+  if (__atomic_add_fetch(&b->arrived, 1, __ATOMIC_ACQ_REL) == b->count) {
+    __atomic_store_n(&b->arrived, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&b->generation, (i32)((u32)gen + 1), __ATOMIC_RELEASE);
+    sys_futex(&b->generation, FUTEX_WAKE, INT32_MAX, NULL);
+    return;
+  }
+
+  while (__atomic_load_n(&b->generation, __ATOMIC_ACQUIRE) == gen) {
+    sys_futex(&b->generation, FUTEX_WAIT, gen, NULL);
+  }
+}
+
+// CPUs this process may run on
+private
+usize cpu_count(void) {
+  u64 mask[16] = {0};
+  i32 bytes = sys_sched_getaffinity(0, sizeof(mask), mask);
+  if (bytes <= 0) {
+    return 1;
+  }
+
+  usize count = 0;
+  for (usize i = 0; i < (usize)bytes / sizeof(u64); i++) {
+    count += (usize)__builtin_popcountl(mask[i]);
+  }
+  return count > 0 ? count : 1;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Int utils
 
@@ -404,6 +981,57 @@ inline u16 u64_to_u16(u64 x) {
   return (u16)x;
 }
 
+private
+inline u32 u64_to_u32(u64 x) {
+  assert(x <= UINT32_MAX);
+
+  return (u32)x;
+}
+
+// Arithmetic which panics on overflow
+#define CHECKED_ADD(X, Y)                                                      \
+  ({                                                                           \
+    __typeof__(X) res_;                                                        \
+    if (__builtin_add_overflow(X, Y, &res_)) {                                 \
+      panic("Overflow\n");                                                     \
+    }                                                                          \
+    res_;                                                                      \
+  })
+
+#define CHECKED_MUL(X, Y)                                                      \
+  ({                                                                           \
+    __typeof__(X) res_;                                                        \
+    if (__builtin_mul_overflow(X, Y, &res_)) {                                 \
+      panic("Overflow\n");                                                     \
+    }                                                                          \
+    res_;                                                                      \
+  })
+
+// There is no libgcc to call into, so 128-bit division is shift and subtract
+private
+u128 u128_divmod(u128 n, u128 d, u128 *rem) {
+  assert(d != 0);
+
+  if (n <= UINT64_MAX && d <= UINT64_MAX) {
+    *rem = (u64)n % (u64)d;
+    return (u64)n / (u64)d;
+  }
+
+  u128 q = 0;
+  u128 r = 0;
+  for (u32 i = 128; i-- > 0;) {
+    bool carry = (r >> 127) != 0;
+    r = r << 1 | ((n >> i) & 1);
+    if (carry || r >= d) {
+      r -= d;
+      q |= (u128)1 << i;
+    }
+  }
+
+  *rem = r;
+  return q;
+}
+
 #define ABS_DIFF(T, X, Y)                                                      \
   ({                                                                           \
     T x = X;                                                                   \
@@ -702,6 +1330,28 @@ Span Span_from_file(const char *path) {
   return ret;
 }
 
+// Make sure `pad` bytes after x can be read (SIMD loads running past the end
+// of x), given the readable memory ends at `end`. x is copied to a fresh zeroed
+// allocation when it is too close to the end.
+//
+// Note: the copy is never freed, this is meant for the last few lines of a
+// file
+private
+Span Span_pad(Span x, usize pad, const u8 *end) {
+  if (x.dat + x.len + pad <= end) {
+    return x;
+  }
+
+  u8 *dat = (u8 *)calloc(1, x.len + pad);
+  memcpy(dat, x.dat, x.len);
+
+  Span ret = {
+      .dat = dat,
+      .len = x.len,
+  };
+  return ret;
+}
+
 private
 Hash Span_hash(const Span *span) {
   FxHasher hasher = {0};
@@ -1128,6 +1778,333 @@ private                                                                        \
                                                                                \
   void REQUIRE_SEMICOLON()
 
+////////////////////////////////////////////////////////////////////////////////
+// Arena
+
+// A bump allocator over a single mmap-ed region. Scratch users take a mark,
+// allocate, and reset back to the mark when they are done.
+typedef struct {
+  u8 *dat;
+  usize len;
+  usize cap;
+} Arena;
+
+private
+Arena Arena_mk(usize cap) {
+  u8 *dat = (u8 *)calloc(1, cap);
+  assert(dat != (void *)-1);
+
+  Arena ret = {
+      .dat = dat,
+      .len = 0,
+      .cap = cap,
+  };
+  return ret;
+}
+
+// align needs to be a power of 2
+private
+void *Arena_alloc(Arena *arena, usize bytes, usize align) {
+  usize start = (arena->len + align - 1) & ~(align - 1);
+  assert(start + bytes <= arena->cap); // Ran out of space
+  arena->len = start + bytes;
+  return arena->dat + start;
+}
+
+private
+inline usize Arena_mark(const Arena *arena) { return arena->len; }
+
+// Note: memory handed out after the mark is not zeroed again
+private
+inline void Arena_reset(Arena *arena, usize mark) {
+  assert(mark <= arena->len);
+  arena->len = mark;
+}
+
+#define ARENA_PUSH(ARENA, T, N)                                                \
+  ((T *)Arena_alloc(ARENA, sizeof(T) * (N), _Alignof(T)))
+
+////////////////////////////////////////////////////////////////////////////////
+// Sort
+
+// Branchless compare-exchange, leaves the smaller value in A
+#define CMP_SWAP(T, A, B)                                                      \
+  do {                                                                         \
+    T a_ = A;                                                                  \
+    T b_ = B;                                                                  \
+    A = a_ < b_ ? a_ : b_;                                                     \
+    B = a_ < b_ ? b_ : a_;                                                     \
+  } while (0)
+
+// Optimal 8 input sorting network (19 comparators, depth 6)
+// https://bertdobbelaere.github.io/sorting_networks.html
+private const u8 sort_network_8[19][2] = {
+    {0, 2}, {1, 3}, {4, 6}, {5, 7}, {0, 4}, {1, 5}, {2, 6},
+    {3, 7}, {0, 1}, {2, 3}, {4, 5}, {6, 7}, {2, 4}, {3, 5},
+    {1, 4}, {3, 6}, {1, 2}, {3, 4}, {5, 6},
+};
+
+// Sort up to 8 elements in ascending order. Shorter inputs are padded with
+// UINT64_MAX so the same network is used for every length.
+private
+void sort_small_u64(u64 *dat, usize len) {
+  assert(len <= 8);
+
+  u64 pad[8] = {
+      UINT64_MAX, UINT64_MAX, UINT64_MAX, UINT64_MAX,
+      UINT64_MAX, UINT64_MAX, UINT64_MAX, UINT64_MAX,
+  };
+  for (usize i = 0; i < len; i++) {
+    pad[i] = dat[i];
+  }
+
+  for (usize i = 0; i < 19; i++) {
+    CMP_SWAP(u64, pad[sort_network_8[i][0]], pad[sort_network_8[i][1]]);
+  }
+
+  for (usize i = 0; i < len; i++) {
+    dat[i] = pad[i];
+  }
+}
+
+// LSD radix sort (8 bits per pass) in ascending order. The ping-pong buffer
+// is taken from the arena and given back before returning.
+//
+// All the histograms are built in one read pass, and passes where every key
+// shares the same digit are skipped (common for small keys in a u64).
+#define define_radix_sort(T)                                                   \
+private                                                                        \
+  void radix_sort_##T(T *dat, usize len, Arena *scratch) {                     \
+    if (len <= 8) {                                                            \
+      u64 small[8];                                                            \
+      for (usize i = 0; i < len; i++) {                                        \
+        small[i] = (u64)dat[i];                                                \
+      }                                                                        \
+      sort_small_u64(small, len);                                              \
+      for (usize i = 0; i < len; i++) {                                        \
+        dat[i] = (T)small[i];                                                  \
+      }                                                                        \
+      return;                                                                  \
+    }                                                                          \
+                                                                               \
+    usize mark = Arena_mark(scratch);                                          \
+    T *tmp = ARENA_PUSH(scratch, T, len);                                      \
+    usize counts[sizeof(T)][256] = {0};                                        \
+                                                                               \
+    for (usize i = 0; i < len; i++) {                                          \
+      T x = dat[i];                                                            \
+      for (usize d = 0; d < sizeof(T); d++) {                                  \
+        counts[d][(x >> (8 * d)) & 0xFF]++;                                    \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    T *src = dat;                                                              \
+    T *dst = tmp;                                                              \
+    for (usize d = 0; d < sizeof(T); d++) {                                    \
+      usize *count = counts[d];                                                \
+                                                                               \
+      /* Every key has the same digit, nothing to do for this pass */          \
+      if (count[(src[0] >> (8 * d)) & 0xFF] == len) {                          \
+        continue;                                                              \
+      }                                                                        \
+                                                                               \
+      usize offset = 0;                                                        \
+      for (usize b = 0; b < 256; b++) {                                        \
+        usize c = count[b];                                                    \
+        count[b] = offset;                                                     \
+        offset += c;                                                           \
+      }                                                                        \
+                                                                               \
+      for (usize i = 0; i < len; i++) {                                        \
+        T x = src[i];                                                          \
+        dst[count[(x >> (8 * d)) & 0xFF]++] = x;                               \
+      }                                                                        \
+                                                                               \
+      T *t = src;                                                              \
+      src = dst;                                                               \
+      dst = t;                                                                 \
+    }                                                                          \
+                                                                               \
+    if (src != dat) {                                                          \
+      memcpy(dat, src, len * sizeof(T));                                       \
+    }                                                                          \
+                                                                               \
+    Arena_reset(scratch, mark);                                                \
+  }                                                                            \
+                                                                               \
+  void REQUIRE_SEMICOLON()
+
+define_radix_sort(u32);
+define_radix_sort(u64);
+
+// Packed key for top_k: larger counts first, then smaller bytes first on ties
+private
+inline u64 top_k_key(u64 count, u8 byte) {
+  return (count << 8) | (u64)(u8)~byte;
+}
+
+private
+inline u8 top_k_key_byte(u64 key) { return (u8)~(u8)key; }
+
+private
+inline u64 top_k_key_count(u64 key) { return key >> 8; }
+
+// Select the k largest keys into out (in descending order) without sorting
+// the whole input. Returns the number of keys written: min(k, len)
+private
+usize top_k_u64(const u64 *keys, usize len, u64 *out, usize k) {
+  usize n = 0;
+
+  for (usize i = 0; i < len; i++) {
+    u64 x = keys[i];
+
+    if (n == k) {
+      if (k == 0 || x <= out[k - 1]) {
+        continue;
+      }
+      n--; // drop the smallest
+    }
+
+    // Insertion into the (small) sorted prefix
+    usize j = n;
+    while (j > 0 && out[j - 1] < x) {
+      out[j] = out[j - 1];
+      j--;
+    }
+    out[j] = x;
+    n++;
+  }
+
+  return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Histogram
+
+// Byte histogram with u32 bins (callers counting more than 4G of the same
+// byte need to split the work)
+typedef struct {
+  u32 dat[256];
+} __attribute__((aligned(32))) Histogram;
+
+#define HISTOGRAM_SUB_COUNT 4
+
+// Count every byte of dat into h.
+//
+// Consecutive equal bytes make a naive `h[x]++` loop wait on its own previous
+// store, so large inputs are spread across HISTOGRAM_SUB_COUNT sub-histograms
+// which get merged with vector adds at the end. Small inputs aren't worth
+// zeroing the sub-histograms for.
+private
+void Histogram_count(Histogram *h, const u8 *dat, usize len) {
+  if (len < 1024) {
+    for (usize i = 0; i < len; i++) {
+      h->dat[dat[i]]++;
+    }
+    return;
+  }
+
+  Histogram sub[HISTOGRAM_SUB_COUNT] = {0};
+
+  usize i = 0;
+  for (; i + 16 <= len; i += 16) {
+    u64 words[2];
+    __builtin_memcpy(words, &dat[i], 16);
+
+    // Fully unrolled, consecutive bytes go to different sub-histograms
+    for (usize j = 0; j < 16; j++) {
+      u8 x = (u8)(words[j / 8] >> (8 * (j % 8)));
+      sub[j % HISTOGRAM_SUB_COUNT].dat[x]++;
+    }
+  }
+
+  for (; i < len; i++) {
+    sub[0].dat[dat[i]]++;
+  }
+
+  for (usize j = 0; j < 256; j += 8) {
+    u32x8 x = u32x8_load(&h->dat[j]);
+    for (usize k = 0; k < HISTOGRAM_SUB_COUNT; k++) {
+      x += u32x8_load(&sub[k].dat[j]);
+    }
+    u32x8_store(&h->dat[j], x);
+  }
+}
+
+// Lanes of the block starting at bin `base` which fall in [from, to)
+private
+inline u32x8 Histogram_range_mask(usize base, usize from, usize to) {
+  const u32x8 lanes = {0, 1, 2, 3, 4, 5, 6, 7};
+  u32x8 bins = lanes + u32x8_splat((u32)base);
+  return (u32x8)(bins >= u32x8_splat((u32)from)) &
+         (u32x8)(bins < u32x8_splat((u32)to));
+}
+
+// Last bin in [from, to) holding `target`
+private
+usize Histogram_find(const Histogram *h, usize from, usize to, u32 target) {
+  for (usize base = (to - 1) & ~7ul;; base -= 8) {
+    u32x8 x = u32x8_load(&h->dat[base]);
+    u32x8 eq = (u32x8)(x == u32x8_splat(target)) &
+               Histogram_range_mask(base, from, to);
+    u32 bits = u32x8_movemask(eq);
+
+    if (bits != 0) {
+      return base + 31 - (usize)__builtin_clz(bits);
+    }
+    if (base <= from) {
+      break;
+    }
+  }
+
+  panic("Histogram_find: not found\n");
+}
+
+// Most frequent bin in [from, to), highest bin wins on ties
+private
+usize Histogram_argmax(const Histogram *h, usize from, usize to) {
+  assert(from < to && to <= 256);
+
+  u32x8 best = {0};
+  for (usize base = from & ~7ul; base < to; base += 8) {
+    u32x8 x = u32x8_load(&h->dat[base]) & Histogram_range_mask(base, from, to);
+    best = u32x8_max(best, x);
+  }
+
+  u32 max = 0;
+  for (usize i = 0; i < 8; i++) {
+    max = best[i] > max ? best[i] : max;
+  }
+
+  return Histogram_find(h, from, to, max);
+}
+
+// Least frequent but non-zero bin in [from, to), highest bin wins on ties.
+// Returns `from` when the whole range is empty.
+private
+usize Histogram_argmin_nonzero(const Histogram *h, usize from, usize to) {
+  assert(from < to && to <= 256);
+
+  u32x8 best = u32x8_splat(UINT32_MAX);
+  for (usize base = from & ~7ul; base < to; base += 8) {
+    u32x8 x = u32x8_load(&h->dat[base]);
+    u32x8 valid = (u32x8)(x != u32x8_splat(0)) &
+                  Histogram_range_mask(base, from, to);
+    best = u32x8_min(best, (x & valid) | ~valid);
+  }
+
+  u32 min = UINT32_MAX;
+  for (usize i = 0; i < 8; i++) {
+    min = best[i] < min ? best[i] : min;
+  }
+
+  if (min == UINT32_MAX) {
+    return from;
+  }
+
+  return Histogram_find(h, from, to, min);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // String
 
@@ -1160,6 +2137,15 @@ void String_push_u64(String *str, u64 x, u8 base) {
   str->len += len;
 }
 
+private
+void String_push_u128(String *str, u128 x, u8 base) {
+  u8 buf[128];
+  usize len = fmt_u128(buf, 128, x, base);
+  assert(str->len + len <= String_capacity);
+  memcpy(&str->dat[str->len], buf, len);
+  str->len += len;
+}
+
 private
 void String_push_i64(String *str, i64 x, u8 base) {
   u8 buf[128];
@@ -1,10 +1,5 @@
 #include "baz.h"
 
-typedef struct {
-  usize count;
-  u8 byte;
-} ByteCount;
-
 define_array(RoomWords, Span, 8);
 
 typedef struct {
@@ -35,7 +30,7 @@ static void Room_decypher(Room room) {
 
 static Room Room_parse(Span room_span) {
   Room room = {0};
-  usize char_count[26] = {0};
+  Histogram char_count = {0};
 
   while (true) {
     SpanSplitOn section_split = Span_split_on((u8)'-', room_span);
@@ -46,12 +41,14 @@ static Room Room_parse(Span room_span) {
 
       room_span = section_split.dat.snd;
 
+      // Sections are short, counting them as they are checked beats a
+      // separate Histogram_count pass
       for (usize i = 0; i < section.len; i++) {
         u8 c = section.dat[i];
         assert(c >= (u8)'a');
         assert(c - 'a' < 26);
 
-        char_count[c - 'a'] += 1;
+        char_count.dat[c] += 1;
       }
     } else {
       // Not a section anymore
@@ -69,34 +66,20 @@ static Room Room_parse(Span room_span) {
 
       usize sector_id = sector_id_parse.dat.fst;
 
-      ByteCount top[5] = {0};
-
-      for (int i = 25; i >= 0; i--) {
-        u8 c = 'a' + (u8) i;
-        usize n = char_count[i];
-
-        for (int j = 0; j < 5; j++) {
-          if (n >= top[j].count) {
-            {
-              u8 t = top[j].byte;
-              top[j].byte = c;
-              c = t;
-            }
-
-            {
-              usize t = top[j].count;
-              top[j].count = n;
-              n = t;
-            }
-          }
-        }
+      u64 keys[26];
+      for (u8 i = 0; i < 26; i++) {
+        keys[i] = top_k_key(char_count.dat['a' + i], 'a' + i);
       }
 
+      u64 top[5];
+      usize top_len = top_k_u64(keys, 26, top, 5);
+      assert(top_len == 5);
+
       assert(checksum.len == 5);
 
       bool checksum_matches = true;
       for (int j = 0; j < 5; j++) {
-        if (top[j].byte != checksum.dat[j]) {
+        if (top_k_key_byte(top[j]) != checksum.dat[j]) {
           checksum_matches = false;
           break;
         }
@@ -105,10 +88,6 @@ static Room Room_parse(Span room_span) {
       room.sector_id = sector_id;
       room.is_real = checksum_matches;
 
-      if (checksum_matches) {
-        Room_decypher(room);
-      }
-
       return room;
     }
   }
@@ -126,6 +105,7 @@ void solve(Span data) {
     Room room = Room_parse(line.dat);
 
     if (room.is_real) {
+      Room_decypher(room);
       part1 += room.sector_id;
     }
 
@@ -138,8 +118,216 @@ void solve(Span data) {
   String_print(&out);
 }
 
+// High-throughput mode: validates every room and only prints the real rooms
+// whose decrypted name contains `target`, without materialising the words.
+//
+// Letters are counted into the lanes of one vector, and names decrypted 32
+// bytes at a time with a vector add and a conditional subtract for the mod 26.
+typedef struct {
+  Span name; // including the '-' between words
+  Span checksum;
+  u64 sector_id;
+} FastRoom;
+
+// Load up to 32 bytes at p, lanes past len are zeroed. end is the end of the
+// underlying buffer: a load which would run past it goes through a copy.
+static inline u8x32 load_masked(const u8 *p, usize len, const u8 *end) {
+  const u8x32 lanes = {0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10,
+                       11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21,
+                       22, 23, 24, 25, 26, 27, 28, 29, 30, 31};
+  len = len < 32 ? len : 32;
+
+  u8x32 x;
+  if (p + 32 <= end) {
+    x = u8x32_load(p);
+  } else {
+    u8 buf[32] = {0};
+    for (usize i = 0; i < len; i++) {
+      buf[i] = p[i];
+    }
+    x = u8x32_load(buf);
+  }
+
+  return x & (u8x32)(lanes < u8x32_splat((u8)len));
+}
+
+// Line shape: <name>-<sector_id>[<checksum>]
+static FastRoom FastRoom_parse(Span line) {
+  assert(line.len >= 9);
+  assert(line.dat[line.len - 1] == ']');
+  assert(line.dat[line.len - 7] == '[');
+
+  usize dash = line.len - 8;
+  while (dash > 0 && line.dat[dash] != '-') {
+    dash--;
+  }
+  assert(line.dat[dash] == '-');
+
+  SpanParseU64 sector_id =
+      Span_parse_u64(Span_slice(line, dash + 1, line.len - 7), 10);
+  assert(sector_id.valid);
+
+  FastRoom room = {
+      .name = Span_slice(line, 0, dash),
+      .checksum = Span_slice(line, line.len - 6, line.len - 1),
+      .sector_id = sector_id.dat.fst,
+  };
+  return room;
+}
+
+// One pass over the name counts the letters in the u8 lanes of a vector, one
+// compare + subtract per byte ('-' gets lane 26, so every valid byte lands
+// somewhere). The checksum is right when its keys are in strictly decreasing
+// order and no other letter beats the last one, no sorting needed.
+static bool FastRoom_is_real(const FastRoom *room) {
+  const u8x32 letters = {'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j',
+                         'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't',
+                         'u', 'v', 'w', 'x', 'y', 'z', '-'};
+  const Span name = room->name;
+  assert(name.len <= UINT8_MAX); // No count can overflow
+
+  // Two chains of adds, for the odd and even bytes
+  u8x32 counts = {0};
+  u8x32 odd = {0};
+  usize i = 0;
+  for (; i + 2 <= name.len; i += 2) {
+    // Matching lane is all ones (-1)
+    counts -= (u8x32)(letters == u8x32_splat(name.dat[i]));
+    odd -= (u8x32)(letters == u8x32_splat(name.dat[i + 1]));
+  }
+  if (i < name.len) {
+    counts -= (u8x32)(letters == u8x32_splat(name.dat[i]));
+  }
+  counts += odd;
+
+  // Only 'a'..'z' and '-' were counted
+  u64x4 sums = (u64x4)__builtin_ia32_psadbw256((i8x32)counts, (i8x32){0});
+  assert(sums[0] + sums[1] + sums[2] + sums[3] == name.len);
+
+  // Branch free, real and fake rooms come in no predictable order
+  bool real = true;
+  u64 prev = UINT64_MAX;
+  u32 in_checksum = 0;
+  for (usize j = 0; j < 5; j++) {
+    u8 c = room->checksum.dat[j];
+    u8 ix = (u8)(c - 'a');
+    real &= ix < 26;
+    ix &= 31; // Lanes past 'z' count nothing
+
+    u64 key = top_k_key(counts[ix], c);
+    real &= key < prev;
+    prev = key;
+    in_checksum |= 1u << ix;
+  }
+
+  // Letters beating the last one of the checksum: more of them, or as many
+  // and earlier in the alphabet
+  u8 last_count = (u8)top_k_key_count(prev);
+  u8 last = top_k_key_byte(prev);
+  u8x32 beats = (u8x32)(counts > u8x32_splat(last_count)) |
+                ((u8x32)(counts == u8x32_splat(last_count)) &
+                 (u8x32)(letters < u8x32_splat(last)));
+  u32 others = u8x32_movemask(beats) & ~in_checksum & ((1u << 26) - 1);
+
+  return real && others == 0;
+}
+
+// Caesar shift 'a'..'z' lanes by shift (< 26), '-' becomes ' '
+static inline u8x32 caesar_shift(u8x32 x, u8 shift) {
+  u8x32 letters = (u8x32)(x >= u8x32_splat('a')) &
+                  (u8x32)(x <= u8x32_splat('z'));
+  u8x32 dashes = (u8x32)(x == u8x32_splat('-'));
+
+  u8x32 v = x - u8x32_splat('a') + u8x32_splat(shift);
+  v -= (u8x32)(v >= u8x32_splat(26)) & u8x32_splat(26);
+
+  return ((v + u8x32_splat('a')) & letters) | (dashes & u8x32_splat(' '));
+}
+
+static void FastRoom_decypher(const FastRoom *room, const u8 *end,
+                              String *out) {
+  assert(room->name.len + 32 <= String_capacity);
+  u8 shift = (u8)(room->sector_id % 26);
+
+  for (usize i = 0; i < room->name.len; i += 32) {
+    u8x32 x = load_masked(&room->name.dat[i], room->name.len - i, end);
+    u8x32_store(&out->dat[i], caesar_shift(x, shift));
+  }
+
+  out->len = room->name.len;
+}
+
+static bool name_contains(const String *str, Span target) {
+  if (target.len == 0) {
+    return true;
+  }
+
+  for (usize i = 0; i + target.len <= str->len;) {
+    const u8 *match = memchr(&str->dat[i], target.dat[0],
+                             str->len - target.len + 1 - i);
+    if (match == NULL) {
+      return false;
+    }
+
+    if (memcmp(match, target.dat, target.len) == 0) {
+      return true;
+    }
+
+    i = (usize)(match - str->dat) + 1;
+  }
+
+  return false;
+}
+
+static void solve_search(Span data, const char *target_str) {
+  Span target = Span_from_str(target_str);
+  const u8 *end = data.dat + data.len;
+
+  usize part1 = 0;
+  String name = {0};
+  String out = {0};
+
+  SpanSplitIterator line_it = Span_split_lines(data);
+  SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
+  while (line.valid) {
+    FastRoom room = FastRoom_parse(line.dat);
+
+    if (FastRoom_is_real(&room)) {
+      part1 += room.sector_id;
+
+      FastRoom_decypher(&room, end, &name);
+      if (name_contains(&name, target)) {
+        Span name_span = {
+            .dat = name.dat,
+            .len = name.len,
+        };
+        String_push_span(&out, name_span);
+        String_push_str(&out, "  ");
+        String_push_u64(&out, room.sector_id, 10);
+        String_printlnc(&out);
+      }
+    }
+
+    line = SpanSplitIterator_next(&line_it);
+  }
+
+  String_push_u64(&out, part1, 10);
+  String_printlnc(&out);
+}
+
+// `day04 [file] [search <target>]`: searching prints only the real rooms whose
+// name contains the target (and the sum)
 int main(void) {
-  Span input = Span_from_file("inputs/day04.txt");
+  const char *modes[] = {"search"};
+  Cli cli = Cli_parse(modes, 1, NULL, 0);
+  Span input = Span_from_file(cli.path != NULL ? cli.path : "inputs/day04.txt");
+
+  if (cli.mode != NULL) {
+    assert(cli.mode_args_len == 1);
+    solve_search(input, cli.mode_args[0]);
+    return 0;
+  }
+
   solve(input);
 
   return 0;
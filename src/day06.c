@@ -1,94 +1,242 @@
 #include "baz.h"
 
+// Column frequency counter for fixed width records of any width.
+//
+// Columns are laid out as SIMD lanes: for every letter there is a row of u8
+// counters, one per column, so counting a line is one compare + subtract per
+// letter for every 32 columns. The u8 counters are flushed into the u64
+// totals before they can overflow.
+//
+// Bytes outside of 'a'..'z' aren't counted.
 typedef struct {
-  u16 dat[26];
-} CharFreqMap;
+  usize width;
+  usize stride; // width rounded up to a multiple of 32
+  usize pending;
+  u8 *counts;   // [26][stride]
+  u64 *totals;  // [26][stride]
+} ColumnCounter;
 
-static inline void CharFreqMap_insert(CharFreqMap *fm, u8 c) {
-  assert(c >= (u8)'a' && c <= (u8)'z');
+static ColumnCounter ColumnCounter_mk(Arena *arena, usize width) {
+  assert(width > 0);
+  usize stride = (width + 31) & ~31ul;
 
-  fm->dat[c - (u8)'a'] += 1;
+  ColumnCounter cc = {
+      .width = width,
+      .stride = stride,
+      .pending = 0,
+      .counts = ARENA_PUSH(arena, u8, 26 * stride),
+      .totals = ARENA_PUSH(arena, u64, 26 * stride),
+  };
+  return cc;
+}
+
+static void ColumnCounter_flush(ColumnCounter *cc) {
+  for (usize i = 0; i < 26 * cc->stride; i++) {
+    cc->totals[i] += cc->counts[i];
+    cc->counts[i] = 0;
+  }
+  cc->pending = 0;
 }
 
-static u8 CharFreqMap_most_frequent(CharFreqMap fm) {
-  u16 max_val = 0;
-  u8 max_ix = 0;
+// line must have `stride` readable bytes, lanes past the width are ignored
+static inline void ColumnCounter_add_line(ColumnCounter *cc, const u8 *line) {
+  const u8x32 lanes = {0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10,
+                       11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21,
+                       22, 23, 24, 25, 26, 27, 28, 29, 30, 31};
+
+  for (usize i = 0; i < cc->stride; i += 32) {
+    u8x32 x = u8x32_load(&line[i]);
+
+    if (i + 32 > cc->width) {
+      x &= (u8x32)(lanes < u8x32_splat((u8)(cc->width - i)));
+    }
 
-  for (u8 i = 0; i < 26; i++) {
-    if (fm.dat[i] >= max_val) {
-      max_val = fm.dat[i];
-      max_ix = i;
+    for (usize c = 0; c < 26; c++) {
+      u8 *row = &cc->counts[c * cc->stride + i];
+      // Matching lanes are all ones (-1)
+      u8x32_store(row, u8x32_load(row) -
+                           (u8x32)(x == u8x32_splat((u8)('a' + c))));
     }
   }
 
-  return max_ix + (u8)'a';
+  cc->pending++;
+  if (cc->pending == UINT8_MAX) {
+    ColumnCounter_flush(cc);
+  }
 }
 
-// Note: least but none-zero
-static u8 CharFreqMap_least_frequent(CharFreqMap fm) {
-  u16 min_val = UINT16_MAX;
-  u8 min_ix = 0;
+// Count every full line of `dat`, returns the number of bytes consumed.
+// `end` is the end of the readable memory around dat, lines too close to it
+// are copied before being loaded.
+static usize ColumnCounter_add_lines(ColumnCounter *cc, const u8 *dat,
+                                     usize len, const u8 *end) {
+  usize line_len = cc->width + 1;
+  usize consumed = 0;
+
+  while (consumed + line_len <= len) {
+    const u8 *line = &dat[consumed];
+    // Every line needs to be the same length
+    assert(line[cc->width] == '\n');
 
-  for (u8 i = 0; i < 26; i++) {
-    if (fm.dat[i] > 0 && fm.dat[i] <= min_val) {
-      min_val = fm.dat[i];
-      min_ix = i;
+    if (line + cc->stride <= end) {
+      ColumnCounter_add_line(cc, line);
+    } else {
+      u8 buf[cc->stride]; // VLA
+      memcpy(buf, line, cc->width);
+      ColumnCounter_add_line(cc, buf);
     }
+
+    consumed += line_len;
   }
 
-  return min_ix + (u8)'a';
+  return consumed;
 }
 
-define_array(FreqMaps, CharFreqMap, 16);
+typedef enum { MostFrequent, LeastFrequent } Frequency;
 
-static void solve(Span input) {
+// Picks of the 4 columns from col, in out. The letters are scanned in order
+// with the columns as u64 lanes, so later letters win ties.
+// Note: least but none-zero, 'a' for a column without any letter
+static void ColumnCounter_pick4(const ColumnCounter *cc, usize col,
+                                Frequency freq, u8 *out) {
+  u64 init = freq == MostFrequent ? 0 : UINT64_MAX;
+  u64x4 best = {init, init, init, init};
+  u64x4 best_ix = {0};
 
-  FreqMaps freq_maps = {0};
-  SpanSplitIterator line_it = {
-      .rest = input,
-      .sep = (u8)'\n',
-  };
+  for (u64 c = 0; c < 26; c++) {
+    u64x4 n = *(const u64x4_unaligned *)&cc->totals[c * cc->stride + col];
+    u64x4 better = freq == MostFrequent
+                       ? (u64x4)(n >= best)
+                       : (u64x4)((n != 0) & (n <= best));
+    best = (n & better) | (best & ~better);
+    best_ix = (better & c) | (best_ix & ~better);
+  }
 
-  bool first_iter = true;
-  SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
-  while (line.valid) {
-    if (first_iter) {
-      first_iter = false;
+  for (usize i = 0; i < 4; i++) {
+    out[i] = (u8)best_ix[i] + (u8)'a';
+  }
+}
 
-      assert(line.dat.len <= 16);
+static void ColumnCounter_print_picks(const ColumnCounter *cc, const char *label,
+                                      Frequency freq) {
+  String out = {0};
+  String_push_str(&out, label);
 
-      // This is valid because freq_map items are 0 initialized
-      freq_maps.len = line.dat.len;
+  // The stride is a multiple of 4, the picks past the width are dropped
+  for (usize i = 0; i < cc->width; i += 4) {
+    if (out.len + 4 > String_capacity) {
+      String_print(&out);
+      String_clear(&out);
     }
+    ColumnCounter_pick4(cc, i, freq, &out.dat[out.len]);
+    out.len += cc->width - i < 4 ? cc->width - i : 4;
+  }
 
-    // Every line needs to be the same length
-    assert(line.dat.len == freq_maps.len);
+  String_print(&out);
+  putchar('\n');
+}
 
-    for (usize i = 0; i < freq_maps.len; i++) {
-      CharFreqMap_insert(&freq_maps.dat[i], line.dat.dat[i]);
-    }
+static void ColumnCounter_print(ColumnCounter *cc) {
+  ColumnCounter_flush(cc);
+  ColumnCounter_print_picks(cc, "Most frequent: ", MostFrequent);
+  ColumnCounter_print_picks(cc, "Least frequent: ", LeastFrequent);
+}
 
-    line = SpanSplitIterator_next(&line_it);
+static usize record_width(Span input) {
+  const u8 *newline = memchr(input.dat, '\n', input.len);
+  return newline == NULL ? input.len : (usize)(newline - input.dat);
+}
+
+static void solve(Span input) {
+  usize width = record_width(input);
+  Arena arena = Arena_mk(26 * 9 * (width + 32) + 64);
+  ColumnCounter cc = ColumnCounter_mk(&arena, width);
+
+  usize consumed =
+      ColumnCounter_add_lines(&cc, input.dat, input.len, input.dat + input.len);
+
+  // Last line without a trailing newline
+  if (consumed < input.len) {
+    assert(input.len - consumed == width);
+    u8 buf[cc.stride]; // VLA
+    memcpy(buf, &input.dat[consumed], width);
+    ColumnCounter_add_line(&cc, buf);
   }
 
-  String out = {0};
-  String_push_str(&out, "Most frequent: ");
-  for (usize i = 0; i < freq_maps.len; i++) {
-    String_push(&out, CharFreqMap_most_frequent(freq_maps.dat[i]));
+  ColumnCounter_print(&cc);
+}
+
+#define STREAM_BUF_SIZE (4 * 1024 * 1024)
+
+// Same as solve, but reading the records from a file descriptor in blocks so
+// inputs larger than memory can be processed.
+static void solve_stream(i32 fd) {
+  // Enough slack after the buffer for a full stride load of the last line
+  Arena arena = Arena_mk(STREAM_BUF_SIZE + 64);
+  u8 *buf = ARENA_PUSH(&arena, u8, STREAM_BUF_SIZE + 32);
+  usize len = 0;
+
+  ColumnCounter cc = {0};
+  bool eof = false;
+
+  while (!eof) {
+    isize n = sys_read(fd, &buf[len], STREAM_BUF_SIZE - len);
+    assert(n >= 0);
+    eof = n == 0;
+    len += (usize)n;
+
+    if (cc.width == 0) {
+      const u8 *newline = memchr(buf, '\n', len);
+      if (newline == NULL && !eof) {
+        // Need the whole first line to know the width
+        assert(len < STREAM_BUF_SIZE);
+        continue;
+      }
+
+      usize width = newline == NULL ? len : (usize)(newline - buf);
+      if (width == 0) {
+        return;
+      }
+      assert(width + 1 + 32 < STREAM_BUF_SIZE);
+      Arena counter_arena = Arena_mk(26 * 9 * (width + 32) + 64);
+      cc = ColumnCounter_mk(&counter_arena, width);
+    }
+
+    usize consumed =
+        ColumnCounter_add_lines(&cc, buf, len, buf + STREAM_BUF_SIZE + 32);
+
+    if (eof && consumed < len) {
+      // Last line without a trailing newline
+      assert(len - consumed == cc.width);
+      ColumnCounter_add_line(&cc, &buf[consumed]);
+      consumed = len;
+    }
+
+    // Keep the partial line for the next read
+    memmove(buf, &buf[consumed], len - consumed);
+    len -= consumed;
   }
-  String_push(&out, '\n');
-  String_print(&out);
 
-  String_clear(&out);
-  String_push_str(&out, "Least frequent: ");
-  for (usize i = 0; i < freq_maps.len; i++) {
-    String_push(&out, CharFreqMap_least_frequent(freq_maps.dat[i]));
+  if (cc.width > 0) {
+    ColumnCounter_print(&cc);
   }
-  String_push(&out, '\n');
-  String_print(&out);
 }
 
+// Pass "-" to read the records from stdin instead
+// `day06 [file|-]`: "-" streams the records from stdin, without a file the
+// example and inputs/day06.txt are solved
 int main(void) {
+  Cli cli = Cli_parse(NULL, 0, NULL, 0);
+  if (cli.path != NULL && streq(cli.path, "-")) {
+    solve_stream(STDIN);
+    return 0;
+  }
+
+  if (cli.path != NULL) {
+    solve(Span_from_file(cli.path));
+    return 0;
+  }
+
   Span example = Span_from_str("eedadn\n"
                                "drvtee\n"
                                "eandsr\n"
@@ -1,104 +1,121 @@
 #include "baz.h"
 
-static bool contains_abba(Span x) {
-  if (x.len < 4) {
-    return false;
+// IPs are scanned in 64 byte windows. Every pattern is found for all the
+// positions of a window at once with shifted compares, and the hypernet
+// sections are found with a prefix XOR of the bracket positions.
+typedef struct {
+  u64 abba_supernet;
+  u64 abba_hypernet;
+  u64 aba_supernet;
+  u64 aba_hypernet;
+} IpWindow;
+
+// Positions where a pattern of `width` bytes fits in the remaining len bytes
+static inline u64 ip_valid_mask(usize len, usize width) {
+  if (len < width) {
+    return 0;
   }
 
-  for (usize i = 0; i < x.len - 3; i++) {
-    if (x.dat[i] == x.dat[i + 3] && x.dat[i + 1] == x.dat[i + 2] &&
-        x.dat[i] != x.dat[i + 1]) {
-      return true;
-    }
-  }
-
-  return false;
+  usize n = len - width + 1;
+  return n >= 64 ? UINT64_MAX : (1ul << n) - 1;
 }
 
-static bool ip_supports_tls(Span ip) {
-  SpanSplitIterator square_it = {
-      .rest = ip,
-      .sep = (u8)'[',
+// p needs 64 + 3 readable bytes, only patterns fully within the first len
+// bytes are reported. `inside` carries the hypernet state between windows.
+static inline IpWindow ip_scan_window(const u8 *p, usize len, bool *inside) {
+  u64 open = u8x64_eq_mask(p, '[');
+  u64 close = u8x64_eq_mask(p, ']');
+  u64 brackets = open | close;
+
+  // Set from a '[' up to (excluding) the next ']'
+  u64 hypernet = u64_prefix_xor(brackets);
+  if (*inside) {
+    hypernet = ~hypernet;
+  }
+  *inside = (hypernet >> 63) & 1;
+
+  u64 eq_01 = u8x64_eq_bytes_mask(p, p + 1);
+  u64 eq_02 = u8x64_eq_bytes_mask(p, p + 2);
+  u64 eq_03 = u8x64_eq_bytes_mask(p, p + 3);
+  u64 eq_12 = u8x64_eq_bytes_mask(p + 1, p + 2);
+
+  // With x[0] == x[3] and x[1] == x[2] (or x[0] == x[2]), the pattern holds
+  // no bracket as long as x[0] and x[1] aren't brackets, and so it sits
+  // within a single section.
+  bool next_bracket = p[64] == '[' || p[64] == ']';
+  u64 no_brackets = ~(brackets | (brackets >> 1) | ((u64)next_bracket << 63));
+
+  u64 abba = eq_03 & eq_12 & ~eq_01 & no_brackets & ip_valid_mask(len, 4);
+  u64 aba = eq_02 & ~eq_01 & no_brackets & ip_valid_mask(len, 3);
+
+  IpWindow ret = {
+      .abba_supernet = abba & ~hypernet,
+      .abba_hypernet = abba & hypernet,
+      .aba_supernet = aba & ~hypernet,
+      .aba_hypernet = aba & hypernet,
   };
+  return ret;
+}
 
-  bool supports_tls = false;
-  bool in_hypernet = false;
+// Bytes of padding the scanner needs after an IP (see Span_pad)
+#define IP_SCAN_PAD (64 + 3)
 
-  SpanSplitIteratorNext section = SpanSplitIterator_next(&square_it);
-  while (section.valid) {
-    bool is_abba = contains_abba(section.dat);
+// One bit per (a, b) letter pair: 26 * 26 = 676 bits
+define_bit_set(AbaSet, u64, 11);
 
-    if (!in_hypernet && is_abba) {
-      supports_tls = true;
-    }
+static inline usize aba_ix(u8 a, u8 b) {
+  assert(a >= 'a' && a <= 'z');
+  assert(b >= 'a' && b <= 'z');
+  return (usize)(a - 'a') * 26 + (usize)(b - 'a');
+}
 
-    if (in_hypernet && is_abba) {
-      supports_tls = false;
-      break;
-    }
+typedef struct {
+  bool tls;
+  bool ssl;
+} IpSupport;
 
-    // Change separator
-    in_hypernet = !in_hypernet;
-    square_it.sep = in_hypernet ? (u8)']' : (u8)'[';
-    section = SpanSplitIterator_next(&square_it);
-  }
+// Single pass over the IP for both answers. Supernet ABAs are recorded as
+// (a, b) and hypernet BABs as the (a, b) of the ABA they need, so SSL support
+// is just a shared bit, whichever section comes first.
+static IpSupport ip_classify(Span ip) {
+  bool abba_supernet = false;
+  bool abba_hypernet = false;
+  bool ssl = false;
 
-  return supports_tls;
-}
+  AbaSet supernet_abas = {0};
+  AbaSet hypernet_babs = {0};
+  bool inside = false;
 
-define_array(SpanArray, Span, 32);
-define_hash_map(SpanHashSet, Span, u8, 32, Span_hash, Span_eq);
+  for (usize base = 0; base < ip.len; base += 64) {
+    IpWindow window = ip_scan_window(&ip.dat[base], ip.len - base, &inside);
 
-static bool ip_supports_ssl(Span ip) {
-  SpanSplitIterator square_it = {
-      .rest = ip,
-      .sep = (u8)'[',
-  };
+    abba_supernet |= window.abba_supernet != 0;
+    abba_hypernet |= window.abba_hypernet != 0;
 
-  bool in_hypernet = false;
-
-  SpanArray in_abas = {0};
-  SpanHashSet out_abas_set = {0};
-
-  SpanSplitIteratorNext section = SpanSplitIterator_next(&square_it);
-  while (section.valid) {
-    if (section.dat.len >= 3) {
-      for (usize i = 0; i < section.dat.len - 2; i++) {
-        if (section.dat.dat[i] == section.dat.dat[i + 2] &&
-            section.dat.dat[i] != section.dat.dat[i + 1]) {
-          // It is an ABA
-          Span aba = Span_slice(section.dat, i, i + 3);
-
-          if (in_hypernet) {
-            SpanArray_push(&in_abas, aba);
-          } else {
-            SpanHashSet_insert(&out_abas_set, aba, 0);
-          }
-        }
-      }
+    if (ssl) {
+      continue;
     }
 
-    // Change separator
-    in_hypernet = !in_hypernet;
-    square_it.sep = in_hypernet ? (u8)']' : (u8)'[';
-    section = SpanSplitIterator_next(&square_it);
-  }
-
-  for (usize i = 0; i < in_abas.len; i++) {
-    Span aba = in_abas.dat[i];
-
-    u8 bab_array[3] = {aba.dat[1], aba.dat[0], aba.dat[1]};
-    Span bab = {
-        .dat = bab_array,
-        .len = 3,
-    };
+    for (u64 bits = window.aba_supernet; bits != 0; bits &= bits - 1) {
+      const u8 *aba = &ip.dat[base + (usize)__builtin_ctzl(bits)];
+      usize ix = aba_ix(aba[0], aba[1]);
+      AbaSet_insert(&supernet_abas, ix);
+      ssl |= AbaSet_contains(hypernet_babs, ix);
+    }
 
-    if (SpanHashSet_contains(&out_abas_set, &bab)) {
-      return true;
+    for (u64 bits = window.aba_hypernet; bits != 0; bits &= bits - 1) {
+      const u8 *bab = &ip.dat[base + (usize)__builtin_ctzl(bits)];
+      usize ix = aba_ix(bab[1], bab[0]);
+      AbaSet_insert(&hypernet_babs, ix);
+      ssl |= AbaSet_contains(supernet_abas, ix);
     }
   }
 
-  return false;
+  IpSupport ret = {
+      .tls = abba_supernet && !abba_hypernet,
+      .ssl = ssl,
+  };
+  return ret;
 }
 
 static void solve(Span input) {
@@ -109,15 +126,13 @@ static void solve(Span input) {
       .sep = (u8)'\n',
   };
 
+  const u8 *end = input.dat + input.len;
+
   SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
   while (line.valid) {
-    if (ip_supports_tls(line.dat)) {
-      part1++;
-    }
-
-    if (ip_supports_ssl(line.dat)) {
-      part2++;
-    }
+    IpSupport support = ip_classify(Span_pad(line.dat, IP_SCAN_PAD, end));
+    part1 += support.tls;
+    part2 += support.ssl;
 
     line = SpanSplitIterator_next(&line_it);
   }
@@ -133,8 +148,10 @@ static void solve(Span input) {
   String_println(&out);
 }
 
+// `day07 [file]`
 int main(void) {
-  Span input = Span_from_file("inputs/day07.txt");
+  Cli cli = Cli_parse(NULL, 0, NULL, 0);
+  Span input = Span_from_file(cli.path != NULL ? cli.path : "inputs/day07.txt");
 
   solve(input);
 
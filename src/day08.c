@@ -1,147 +1,399 @@
 #include "baz.h"
 
+///////////////////////////////////////////////////////////////////////////////
+// Bit vectors (bit i of a vector lives in word i / 64, bits past the length
+// are kept at 0)
+
+static inline usize bits_words(usize len) { return (len + 63) / 64; }
+
+static inline bool bits_get(const u64 *v, usize i) {
+  return (v[i / 64] >> (i % 64)) & 1;
+}
+
+static inline void bits_set(u64 *v, usize i, bool on) {
+  u64 bit = 1ul << (i % 64);
+  v[i / 64] = on ? v[i / 64] | bit : v[i / 64] & ~bit;
+}
+
+// Set bits [0, n)
+static void bits_fill(u64 *v, usize n) {
+  for (usize i = 0; i < n / 64; i++) {
+    v[i] = UINT64_MAX;
+  }
+  if (n % 64 != 0) {
+    v[n / 64] |= (1ul << (n % 64)) - 1;
+  }
+}
+
+// Read `count` (<= 64) bits starting at `from`, without wrapping
+static inline u64 bits_read(const u64 *v, usize from, usize count) {
+  usize word = from / 64;
+  usize offset = from % 64;
+
+  u64 x = v[word] >> offset;
+  if (offset != 0 && offset + count > 64) {
+    x |= v[word + 1] << (64 - offset);
+  }
+
+  return count == 64 ? x : x & ((1ul << count) - 1);
+}
+
+// dst[i] = src[(i - rot) mod len], a word at a time
+static void bits_rotate(u64 *dst, const u64 *src, usize len, usize rot) {
+  rot %= len;
+
+  if (len <= 64) {
+    u64 x = src[0];
+    u64 mask = len == 64 ? UINT64_MAX : (1ul << len) - 1;
+    dst[0] = rot == 0 ? x : ((x << rot) | (x >> (len - rot))) & mask;
+    return;
+  }
+
+  // Every destination word reads 64 bits starting at (64 * k - rot) mod len,
+  // which wraps at most once since len > 64
+  usize from = rot == 0 ? 0 : len - rot;
+  for (usize k = 0; k < bits_words(len); k++) {
+    if (likely(from + 64 <= len)) {
+      dst[k] = bits_read(src, from, 64);
+      from += 64;
+    } else {
+      usize first = len - from;
+      u64 x = bits_read(src, from, first);
+      if (first < 64) {
+        x |= bits_read(src, 0, 64 - first) << first;
+      }
+      dst[k] = x;
+      from = 64 - first;
+    }
+  }
+
+  if (len % 64 != 0) {
+    dst[len / 64] &= (1ul << (len % 64)) - 1;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Screen
+
+// A width x height bit matrix kept both row-major (for row rotations) and
+// column-major (for column rotations). Only one of them needs to be up to date
+// at a time, the other one is rebuilt lazily with 64x64 block transposes.
 typedef struct {
-  u64 rows[6];
+  usize width;
+  usize height;
+  usize row_words; // words per row
+  usize col_words; // words per column
+  u64 *rows;       // [height][row_words]
+  u64 *cols;       // [width][col_words]
+  u64 *scratch;    // one row or column
+  bool rows_valid;
+  bool cols_valid;
 } Screen;
 
-private
-void Screen_print(const Screen *screen) {
-  String out = {0};
-  for (u64 row_ix = 0; row_ix < 6; row_ix++) {
-    for (u64 col_ix = 0; col_ix < 50; col_ix++) {
-      bool on = ((screen->rows[row_ix] >> col_ix) & 1ull) == 1ull;
-      String_push(&out, on ? '#' : '.');
+static Screen Screen_mk(Arena *arena, usize width, usize height) {
+  assert(width > 0 && height > 0);
+
+  usize row_words = bits_words(width);
+  usize col_words = bits_words(height);
+  usize scratch_words = row_words > col_words ? row_words : col_words;
+
+  Screen screen = {
+      .width = width,
+      .height = height,
+      .row_words = row_words,
+      .col_words = col_words,
+      .rows = ARENA_PUSH(arena, u64, height * row_words),
+      .cols = ARENA_PUSH(arena, u64, width * col_words),
+      .scratch = ARENA_PUSH(arena, u64, scratch_words),
+      .rows_valid = true,
+      .cols_valid = true,
+  };
+  return screen;
+}
+
+// from is [n_from][from_words] with n_from bits per line, to is the transposed
+// [n_to][to_words]
+static void bit_matrix_transpose(u64 *to, usize to_words, const u64 *from,
+                                 usize from_words, usize n_from, usize n_to) {
+  u64 block[64];
+
+  // Row blocks outer, so the 64 rows being read stay in cache while we walk
+  // along them
+  for (usize bj = 0; bj < n_from; bj += 64) {
+    for (usize bi = 0; bi < from_words * 64 && bi < n_to; bi += 64) {
+      for (usize r = 0; r < 64; r++) {
+        block[r] = bj + r < n_from ? from[(bj + r) * from_words + bi / 64] : 0;
+      }
+
+      bit_transpose64(block);
+
+      for (usize c = 0; c < 64 && bi + c < n_to; c++) {
+        to[(bi + c) * to_words + bj / 64] = block[c];
+      }
     }
-    String_printlnc(&out);
+  }
+}
+
+static void Screen_sync_rows(Screen *screen) {
+  if (!screen->rows_valid) {
+    bit_matrix_transpose(screen->rows, screen->row_words, screen->cols,
+                         screen->col_words, screen->width, screen->height);
+    screen->rows_valid = true;
+  }
+}
+
+static void Screen_sync_cols(Screen *screen) {
+  if (!screen->cols_valid) {
+    bit_matrix_transpose(screen->cols, screen->col_words, screen->rows,
+                         screen->row_words, screen->height, screen->width);
+    screen->cols_valid = true;
   }
 }
 
 static usize Screen_count(const Screen *screen) {
-  usize count = 0;
+  const u64 *dat = screen->rows_valid ? screen->rows : screen->cols;
+  usize words = screen->rows_valid ? screen->height * screen->row_words
+                                   : screen->width * screen->col_words;
 
-  for (usize row_ix = 0; row_ix < 6; row_ix++) {
-    count += (usize)__builtin_popcountl(screen->rows[row_ix]);
+  usize count = 0;
+  for (usize i = 0; i < words; i++) {
+    count += (usize)__builtin_popcountl(dat[i]);
   }
 
   return count;
 }
 
-static void Screen_rect(Screen *screen, u64 a, u64 b) {
-  assert(a < 50);
-  assert(b < 6);
+private
+void Screen_print(Screen *screen) {
+  Screen_sync_rows(screen);
 
-  for (u64 row_ix = 0; row_ix < b; row_ix++) {
-    screen->rows[row_ix] |= (1ull << a) - 1ull;
+  String out = {0};
+  for (usize row_ix = 0; row_ix < screen->height; row_ix++) {
+    const u64 *row = &screen->rows[row_ix * screen->row_words];
+
+    for (usize col_ix = 0; col_ix < screen->width; col_ix++) {
+      if (out.len == String_capacity) {
+        String_print(&out);
+        String_clear(&out);
+      }
+      String_push(&out, bits_get(row, col_ix) ? '#' : '.');
+    }
+
+    String_print(&out);
+    String_clear(&out);
+    putchar('\n');
   }
 }
 
-static void Screen_rotate_row(Screen *screen, u64 y, u64 n) {
-  assert(y < 6);
+// Turn on the a x b top left rectangle, in whichever layout is up to date
+static void Screen_rect(Screen *screen, usize a, usize b) {
+  assert(a <= screen->width);
+  assert(b <= screen->height);
 
-  u64 row = screen->rows[y];
-  u64 rot = n % 50;
+  if (screen->rows_valid) {
+    for (usize row_ix = 0; row_ix < b; row_ix++) {
+      bits_fill(&screen->rows[row_ix * screen->row_words], a);
+    }
+    screen->cols_valid = false;
+  } else {
+    for (usize col_ix = 0; col_ix < a; col_ix++) {
+      bits_fill(&screen->cols[col_ix * screen->col_words], b);
+    }
+    screen->rows_valid = false;
+  }
+}
 
-  u64 row_mask = (1ull << 50) - 1ull;
-  u64 bottom_mask = (1ull << rot) - 1ull;
-  u64 top_mask = row_mask & ~bottom_mask;
+// Rotate line `ix` of `lines` ([n][words], len bits each) by n. With
+// `transposed` the line is a column of the other layout: it is gathered a
+// bit at a time, rotated and scattered back.
+static void rotate_line(u64 *lines, usize words, usize len, usize ix, usize n,
+                        u64 *scratch, bool transposed, usize other_words) {
+  if (!transposed) {
+    u64 *line = &lines[ix * words];
+    bits_rotate(scratch, line, len, n);
+    memcpy(line, scratch, words * sizeof(u64));
+    return;
+  }
 
-  u64 top = (row << rot) & top_mask;
-  u64 bottom = (row >> (50 - rot)) & bottom_mask;
+  u64 *gathered = scratch;
+  u64 rotated[bits_words(len)]; // VLA
 
-  screen->rows[y] = top | bottom;
-}
+  for (usize i = 0; i < bits_words(len); i++) {
+    gathered[i] = 0;
+  }
+  for (usize i = 0; i < len; i++) {
+    bits_set(gathered, i, bits_get(&lines[i * other_words], ix));
+  }
 
-static void Screen_rotate_column(Screen *screen, u64 x, u64 n) {
-  assert(x < 50);
-  u64 col = 0;
+  bits_rotate(rotated, gathered, len, n);
 
-  for (u64 row_ix = 0; row_ix < 6; row_ix++) {
-    col |= ((screen->rows[row_ix] >> x) & 1) << row_ix;
+  for (usize i = 0; i < len; i++) {
+    bits_set(&lines[i * other_words], ix, bits_get(rotated, i));
   }
+}
 
-  for (int row_ix = 0; row_ix < 6; row_ix++) {
-    int rot_row_ix = ( 6 + row_ix - (int) n) % 6;
+// `direct` rotates in the up to date layout (1 bit per cell of the row)
+// instead of switching layouts, see solve
+static void Screen_rotate_row(Screen *screen, usize y, usize n, bool direct) {
+  assert(y < screen->height);
 
-    if (((col >> rot_row_ix) & 1) == 1) {
-      screen->rows[row_ix] |= 1ull << x;
-    } else {
-      screen->rows[row_ix] &= ~(1ull << x);
-    }
+  if (direct && !screen->rows_valid) {
+    rotate_line(screen->cols, screen->col_words, screen->width, y, n,
+                screen->scratch, true, screen->col_words);
+    return;
   }
+
+  Screen_sync_rows(screen);
+  rotate_line(screen->rows, screen->row_words, screen->width, y, n,
+              screen->scratch, false, 0);
+  screen->cols_valid = false;
 }
 
-static void solve(Span input) {
-  Screen screen = {0};
+static void Screen_rotate_column(Screen *screen, usize x, usize n,
+                                 bool direct) {
+  assert(x < screen->width);
 
-  SpanSplitIterator line_it = {
-      .rest = input,
-      .sep = (u8)'\n',
-  };
+  if (direct && !screen->cols_valid) {
+    rotate_line(screen->rows, screen->row_words, screen->height, x, n,
+                screen->scratch, true, screen->row_words);
+    return;
+  }
 
-  SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
-  while (line.valid) {
+  Screen_sync_cols(screen);
+  rotate_line(screen->cols, screen->col_words, screen->height, x, n,
+              screen->scratch, false, 0);
+  screen->rows_valid = false;
+}
 
-    Span rect = Span_from_str("rect ");
-    Span rotate_row = Span_from_str("rotate row y=");
-    Span rotate_col = Span_from_str("rotate column x=");
+///////////////////////////////////////////////////////////////////////////////
+// Instructions
 
-    if (Span_starts_with(line.dat, rect)) {
-      Span rest = Span_slice(line.dat, rect.len, line.dat.len);
-      SpanParseU64 a_parse = Span_parse_u64(rest, 10);
-      assert(a_parse.valid);
+typedef struct {
+  enum { Rect, RotateRow, RotateColumn } tag;
+  usize a;
+  usize b;
+} Instr;
+
+static Instr Instr_parse(Span line) {
+  Span rect = Span_from_str("rect ");
+  Span rotate_row = Span_from_str("rotate row y=");
+  Span rotate_col = Span_from_str("rotate column x=");
+
+  Instr instr = {0};
+  usize skip = 0;
+
+  if (Span_starts_with(line, rect)) {
+    instr.tag = Rect;
+    line = Span_slice(line, rect.len, line.len);
+    skip = 1; // "x"
+  } else if (Span_starts_with(line, rotate_row)) {
+    instr.tag = RotateRow;
+    line = Span_slice(line, rotate_row.len, line.len);
+    skip = 4; // " by "
+  } else if (Span_starts_with(line, rotate_col)) {
+    instr.tag = RotateColumn;
+    line = Span_slice(line, rotate_col.len, line.len);
+    skip = 4; // " by "
+  } else {
+    panic("unexpected");
+  }
 
-      Span rest2 = Span_slice(a_parse.dat.snd, 1, a_parse.dat.snd.len);
-      SpanParseU64 b_parse = Span_parse_u64(rest2, 10);
-      assert(b_parse.valid);
+  SpanParseU64 a_parse = Span_parse_u64(line, 10);
+  assert(a_parse.valid);
 
-      usize a = a_parse.dat.fst;
-      usize b = b_parse.dat.fst;
-      Screen_rect(&screen, a, b);
+  Span rest = Span_slice(a_parse.dat.snd, skip, a_parse.dat.snd.len);
+  SpanParseU64 b_parse = Span_parse_u64(rest, 10);
+  assert(b_parse.valid);
 
-    } else if (Span_starts_with(line.dat, rotate_row)) {
-      Span rest = Span_slice(line.dat, rotate_row.len, line.dat.len);
-      SpanParseU64 y_parse = Span_parse_u64(rest, 10);
-      assert(y_parse.valid);
+  instr.a = a_parse.dat.fst;
+  instr.b = b_parse.dat.fst;
+  return instr;
+}
 
-      Span rest2 = Span_slice(y_parse.dat.snd, 4, y_parse.dat.snd.len);
-      SpanParseU64 n_parse = Span_parse_u64(rest2, 10);
-      assert(n_parse.valid);
+static void solve(Span input, usize width, usize height) {
+  // Every instruction line is at least 8 bytes ("rect 1x1")
+  usize max_instrs = input.len / 8 + 1;
+  Arena arena = Arena_mk(max_instrs * sizeof(Instr) +
+                         (height + 1) * bits_words(width) * 8 +
+                         (width + 1) * bits_words(height) * 8 + 256);
 
-      usize y = y_parse.dat.fst;
-      usize n = n_parse.dat.fst;
+  Instr *instrs = ARENA_PUSH(&arena, Instr, max_instrs);
+  usize len = 0;
 
-      Screen_rotate_row(&screen, y, n);
+  SpanSplitIterator line_it = Span_split_lines(input);
+  SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
+  while (line.valid) {
+    instrs[len++] = Instr_parse(line.dat);
+    line = SpanSplitIterator_next(&line_it);
+  }
 
-    } else if (Span_starts_with(line.dat, rotate_col)) {
-      Span rest = Span_slice(line.dat, rotate_col.len, line.dat.len);
-      SpanParseU64 x_parse = Span_parse_u64(rest, 10);
-      assert(x_parse.valid);
+  Screen screen = Screen_mk(&arena, width, height);
 
-      Span rest2 = Span_slice(x_parse.dat.snd, 4, x_parse.dat.snd.len);
-      SpanParseU64 n_parse = Span_parse_u64(rest2, 10);
-      assert(n_parse.valid);
+  // A full transpose costs about one word op per 64 cells while a direct
+  // rotation in the other layout costs one op per cell of the line. Look at
+  // how many rotations along the same axis are coming up (rects work in
+  // either layout) to decide whether switching layouts is worth it.
+  usize transpose_cost = width * height / 64 * 8;
+  usize run_end = 0;
+  bool direct = false;
 
-      usize x = x_parse.dat.fst;
-      usize n = n_parse.dat.fst;
+  for (usize i = 0; i < len; i++) {
+    Instr instr = instrs[i];
 
-      Screen_rotate_column(&screen, x, n);
-    } else {
-      panic("unexpected");
+    if (instr.tag != Rect && i >= run_end) {
+      usize rotations = 0;
+      usize line_cost = instr.tag == RotateRow ? width : height;
+
+      run_end = i;
+      while (run_end < len && instrs[run_end].tag != (instr.tag == RotateRow
+                                                          ? RotateColumn
+                                                          : RotateRow)) {
+        rotations += instrs[run_end].tag == instr.tag;
+        run_end++;
+      }
+
+      direct = rotations * line_cost < transpose_cost;
     }
 
+    switch (instr.tag) {
+    case Rect:
+      Screen_rect(&screen, instr.a, instr.b);
+      break;
+    case RotateRow:
+      Screen_rotate_row(&screen, instr.a, instr.b, direct);
+      break;
+    case RotateColumn:
+      Screen_rotate_column(&screen, instr.a, instr.b, direct);
+      break;
+    }
+  }
 
-    line = SpanSplitIterator_next(&line_it);
+  if (width * height <= 64 * 1024) {
+    Screen_print(&screen);
   }
 
-  Screen_print(&screen);
   String out = {0};
   String_push_u64(&out, Screen_count(&screen), 10);
   String_println(&out);
 }
 
+static usize parse_arg(const char *arg) {
+  return UNWRAP(Span_parse_u64(Span_from_str(arg), 10)).fst;
+}
+
+// `day08 [file] [--width <w>] [--height <h>]`, the screen is 50x6 by default
 int main(void) {
-  Span input = Span_from_file("inputs/day08.txt");
-  solve(input);
+  const CliFlag flags[] = {
+      {.name = "--width", .value = true},
+      {.name = "--height", .value = true},
+  };
+  Cli cli = Cli_parse(NULL, 0, flags, 2);
+
+  const char *width = Cli_value(&cli, "--width");
+  const char *height = Cli_value(&cli, "--height");
+  Span input = Span_from_file(cli.path != NULL ? cli.path : "inputs/day08.txt");
+  solve(input, width != NULL ? parse_arg(width) : 50,
+        height != NULL ? parse_arg(height) : 6);
 
   return 0;
 }
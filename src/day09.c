@@ -1,8 +1,8 @@
 #include "baz.h"
 
 typedef struct {
-  u16 num_char;
-  u16 repeat;
+  u64 num_char;
+  u64 repeat;
 } Marker;
 
 // Return the Span after the marker's closing ')'
@@ -10,68 +10,568 @@ typedef struct {
 Span parse_marker(Span input, Marker *out) {
   SpanParseU64 res_num_char = Span_parse_u64(input, 10);
   assert(res_num_char.valid);
-  out->num_char = u64_to_u16(res_num_char.dat.fst);
+  out->num_char = res_num_char.dat.fst;
 
   input = Span_trim_start(res_num_char.dat.snd, Span_from_str("x"));
 
   SpanParseU64 res_repeat = Span_parse_u64(input, 10);
   assert(res_repeat.valid);
-  out->repeat = u64_to_u8(res_repeat.dat.fst);
+  out->repeat = res_repeat.dat.fst;
 
   input = Span_trim_start(res_repeat.dat.snd, Span_from_str(")"));
 
   return input;
 }
 
-u64 solve(Span input, bool recurse) {
-  u64 count = 0;
+static inline bool is_whitespace(u8 c) {
+  return c == ' ' || c == '\n' || c == '\t';
+}
 
-  while (input.len > 0) {
-    // Whitespace is ignored
-    input = Span_trim_start_whitespace(input);
+// Decompressed length in a single forward pass, fed with consecutive chunks
+// of the compressed stream (so it can run on streams of any size).
+//
+// Without `recurse` the data of a marker is skipped over. With it, every
+// marker pushes a frame covering its data which multiplies the length of
+// everything in it by the repeat count. Whitespace is ignored.
 
-    SpanSplitOn to_marker = Span_split_on('(', input);
-    SpanSplitOn to_newline = Span_split_on('\n', input);
+// "(" + 20 digits + "x" + 20 digits + ")"
+#define MARKER_MAX_LEN 43
+#define FRAME_CAPACITY (16 * 1024 * 1024)
 
-    if (to_marker.valid &&
-        (!to_newline.valid || to_marker.dat.fst.len < to_newline.dat.fst.len)) {
-      // Dealing with marker
-      u64 advance = (u64)to_marker.dat.fst.len;
-      count += advance;
+typedef struct {
+  u64 end; // stream offset where the marker's data ends
+  u128 multiplier;
+} Frame;
 
-      Marker m;
-      input = parse_marker(to_marker.dat.snd, &m);
+typedef struct {
+  bool recurse;
+  u64 pos;  // stream offset of the next byte
+  u64 skip; // bytes of marker data left to skip (without recurse)
+  u128 total;
 
-      Span recursive = Span_slice(input, 0, m.num_char);
-      input = Span_slice(input, m.num_char, input.len);
+  Frame *frames; // the marker data we are in, innermost last
+  usize depth;
 
-      if (recurse) {
-        count += solve(recursive, true) * (u64)m.repeat;
-      } else {
-        count += (u64)m.num_char * (u64)m.repeat;
+  // A marker split across chunks
+  u8 marker[MARKER_MAX_LEN];
+  usize marker_len;
+} Decompressor;
+
+static Decompressor Decompressor_mk(bool recurse) {
+  Decompressor d = {0};
+  d.recurse = recurse;
+  if (recurse) {
+    // Only the pages actually used get mapped in
+    d.frames = (Frame *)calloc(FRAME_CAPACITY, sizeof(Frame));
+  }
+  return d;
+}
+
+static inline u128 Decompressor_multiplier(const Decompressor *d) {
+  return d->depth == 0 ? 1 : d->frames[d->depth - 1].multiplier;
+}
+
+static inline void Decompressor_pop_frames(Decompressor *d) {
+  while (d->depth > 0 && d->frames[d->depth - 1].end <= d->pos) {
+    // Markers can't straddle the end of their parent's data
+    assert(d->frames[d->depth - 1].end == d->pos);
+    d->depth--;
+  }
+}
+
+// Literal bytes, stopping at every end of frame to update the multiplier
+static void Decompressor_text(Decompressor *d, const u8 *dat, usize len) {
+  while (len > 0) {
+    usize n = len;
+    if (d->depth > 0 && d->frames[d->depth - 1].end - d->pos < n) {
+      n = d->frames[d->depth - 1].end - d->pos;
+    }
+
+    u64 chars = 0;
+    for (usize i = 0; i < n; i++) {
+      chars += !is_whitespace(dat[i]);
+    }
+
+    u128 expanded = CHECKED_MUL((u128)chars, Decompressor_multiplier(d));
+    d->total = CHECKED_ADD(d->total, expanded);
+
+    d->pos += n;
+    dat += n;
+    len -= n;
+    Decompressor_pop_frames(d);
+  }
+}
+
+// `len` is the length of the marker text, which the stream position is at the
+// end of
+static void Decompressor_marker(Decompressor *d, Marker m, usize len) {
+  d->pos += len;
+
+  if (!d->recurse) {
+    d->total = CHECKED_ADD(d->total, CHECKED_MUL((u128)m.num_char, m.repeat));
+    d->skip = m.num_char;
+    return;
+  }
+
+  Decompressor_pop_frames(d);
+  assert(d->depth < FRAME_CAPACITY);
+
+  u64 end = CHECKED_ADD(d->pos, m.num_char);
+  if (d->depth > 0) {
+    assert(end <= d->frames[d->depth - 1].end);
+  }
+
+  Frame frame = {
+      .end = end,
+      .multiplier = CHECKED_MUL(Decompressor_multiplier(d), (u128)m.repeat),
+  };
+  d->frames[d->depth++] = frame;
+
+  // Empty marker data
+  Decompressor_pop_frames(d);
+}
+
+static void Decompressor_feed(Decompressor *d, Span chunk) {
+  while (chunk.len > 0) {
+    if (d->marker_len > 0) {
+      // Finishing a marker, one byte at a time as they are short
+      u8 c = chunk.dat[0];
+      chunk = Span_slice(chunk, 1, chunk.len);
+
+      assert(d->marker_len < MARKER_MAX_LEN);
+      d->marker[d->marker_len++] = c;
+
+      if (c == ')') {
+        Span text = {
+            .dat = &d->marker[1],
+            .len = d->marker_len - 1,
+        };
+        Marker m;
+        parse_marker(text, &m);
+
+        Decompressor_marker(d, m, d->marker_len);
+        d->marker_len = 0;
       }
-    } else if (to_newline.valid) {
-      // Dealing with text
-      u64 advance = (u64)to_newline.dat.fst.len;
-      count += advance;
-      input = to_newline.dat.snd;
-    } else {
-      count += input.len;
-      break;
+      continue;
+    }
+
+    if (d->skip > 0) {
+      usize n = d->skip < chunk.len ? d->skip : chunk.len;
+      d->skip -= n;
+      d->pos += n;
+      chunk = Span_slice(chunk, n, chunk.len);
+      continue;
+    }
+
+    const u8 *open = memchr(chunk.dat, '(', chunk.len);
+    usize text_len = open == NULL ? chunk.len : (usize)(open - chunk.dat);
+
+    Decompressor_text(d, chunk.dat, text_len);
+    chunk = Span_slice(chunk, text_len, chunk.len);
+
+    if (open != NULL) {
+      d->marker[0] = '(';
+      d->marker_len = 1;
+      chunk = Span_slice(chunk, 1, chunk.len);
     }
   }
+}
 
-  return count;
+static u128 Decompressor_finish(const Decompressor *d) {
+  // Truncated marker
+  assert(d->marker_len == 0);
+  return d->total;
 }
 
-int main(void) {
-  Span input = Span_from_file("inputs/day09.txt");
+static void print_totals(const Decompressor *part1, const Decompressor *part2) {
   String out = {0};
-  String_push_u64(&out, solve(input, false), 10);
+  String_push_u128(&out, Decompressor_finish(part1), 10);
   String_printlnc(&out);
 
-  String_push_u64(&out, solve(input, true), 10);
+  String_push_u128(&out, Decompressor_finish(part2), 10);
   String_printlnc(&out);
+}
+
+// Random access into the (recursive) decompressed output, without
+// materialising it.
+//
+// The index is a tree of segments: literal runs of the input, and markers
+// whose children are the segments of their data. Every segment knows its
+// expanded weight and its start offset within one copy of its parent, and the
+// children of a marker are contiguous, so seeking is a binary search per
+// level. The input has to stay mapped as text segments point into it.
+typedef struct {
+  u128 weight; // expanded length, repeats included
+  u128 start;  // offset within one repetition of the parent
+  u64 first;   // Text: offset in the input, Repeat: first child
+  u64 count;   // Repeat: number of children (0 for Text)
+  u64 repeat;  // Repeat: repeat count (0 for Text)
+} Segment;
+
+static inline bool Segment_is_text(const Segment *s) { return s->repeat == 0; }
+
+// Expanded length of one repetition
+static inline u128 Segment_unit(const Segment *s) {
+  if (Segment_is_text(s)) {
+    return s->weight;
+  }
+
+  u128 rem;
+  return u128_divmod(s->weight, s->repeat, &rem);
+}
+
+typedef struct {
+  Span input;
+  Segment root; // Whole input, repeated once
+  Segment *segments;
+  usize max_depth;
+} DecompressedIndex;
+
+typedef struct {
+  u64 end;
+  usize pending_start;
+  u64 repeat;
+} IndexFrame;
+
+typedef struct {
+  Segment *segments;
+  usize len;
+} SegmentArray;
+
+static void SegmentArray_push(SegmentArray *array, Segment s) {
+  array->segments[array->len++] = s;
+}
+
+// Move the pending children from `from` into the index, returns the
+// enclosing Repeat segment
+static Segment DecompressedIndex_close(DecompressedIndex *ix, usize *len,
+                                       SegmentArray *pending, usize from,
+                                       u64 repeat) {
+  usize first = *len;
+  u128 unit = 0;
+
+  for (usize i = from; i < pending->len; i++) {
+    Segment child = pending->segments[i];
+    child.start = unit;
+    unit = CHECKED_ADD(unit, child.weight);
+    ix->segments[(*len)++] = child;
+  }
+
+  Segment ret = {
+      .weight = CHECKED_MUL(unit, (u128)repeat),
+      .first = first,
+      .count = pending->len - from,
+      .repeat = repeat,
+  };
+  pending->len = from;
+  return ret;
+}
+
+// Literal text, one segment per whitespace separated run
+static void push_text(SegmentArray *pending, Span input, u64 from, u64 to) {
+  while (from < to) {
+    while (from < to && is_whitespace(input.dat[from])) {
+      from++;
+    }
+
+    u64 run = from;
+    while (run < to && !is_whitespace(input.dat[run])) {
+      run++;
+    }
+
+    if (run > from) {
+      Segment text = {
+          .weight = run - from,
+          .first = from,
+      };
+      SegmentArray_push(pending, text);
+    }
+    from = run;
+  }
+}
+
+static DecompressedIndex DecompressedIndex_build(Span input) {
+  // Every segment (and frame) takes at least one byte of input
+  DecompressedIndex ix = {
+      .input = input,
+      .segments = (Segment *)calloc(input.len + 1, sizeof(Segment)),
+  };
+  SegmentArray pending = {
+      .segments = (Segment *)calloc(input.len + 1, sizeof(Segment)),
+  };
+  IndexFrame *frames = (IndexFrame *)calloc(input.len + 1, sizeof(IndexFrame));
+  usize depth = 0;
+  usize len = 0;
+
+  u64 pos = 0;
+  while (true) {
+    while (depth > 0 && frames[depth - 1].end == pos) {
+      IndexFrame frame = frames[--depth];
+      Segment s = DecompressedIndex_close(&ix, &len, &pending,
+                                          frame.pending_start, frame.repeat);
+      SegmentArray_push(&pending, s);
+    }
+
+    if (pos == input.len) {
+      break;
+    }
+
+    u64 end = depth > 0 ? frames[depth - 1].end : input.len;
+    const u8 *open = memchr(&input.dat[pos], '(', end - pos);
+    u64 text_end = open == NULL ? end : (u64)(open - input.dat);
+
+    push_text(&pending, input, pos, text_end);
+    pos = text_end;
+
+    if (open != NULL) {
+      Marker m;
+      Span rest = parse_marker(Span_slice(input, pos + 1, end), &m);
+      pos = end - rest.len;
+      assert(input.dat[pos - 1] == ')');
+
+      u64 data_end = CHECKED_ADD(pos, m.num_char);
+      assert(data_end <= end);
+
+      IndexFrame frame = {
+          .end = data_end,
+          .pending_start = pending.len,
+          .repeat = m.repeat,
+      };
+      frames[depth++] = frame;
+      ix.max_depth = depth > ix.max_depth ? depth : ix.max_depth;
+    }
+  }
+
+  ix.root = DecompressedIndex_close(&ix, &len, &pending, 0, 1);
+
+  free(pending.segments);
+  free(frames);
+  return ix;
+}
+
+// Where we are in the tree: for every level, the Repeat segment, which
+// repetition of it and which child
+typedef struct {
+  const Segment *seg;
+  u64 rep;
+  u64 child;
+} CursorFrame;
+
+typedef struct {
+  const DecompressedIndex *ix;
+  CursorFrame *stack; // max_depth + 1 frames
+  usize depth;        // 0 once the end is reached
+  u64 text_off;       // within the current text segment
+} Cursor;
+
+static inline const Segment *Cursor_child(const Cursor *c,
+                                          const CursorFrame *f) {
+  return &c->ix->segments[f->seg->first + f->child];
+}
+
+// Go down to the first text segment from the current child of the top frame,
+// skipping over anything that expands to nothing. Returns false when the top
+// frame has no such child left.
+static bool Cursor_descend(Cursor *c) {
+  while (true) {
+    CursorFrame *f = &c->stack[c->depth - 1];
+
+    while (f->child < f->seg->count && Cursor_child(c, f)->weight == 0) {
+      f->child++;
+    }
+    if (f->child == f->seg->count) {
+      return false;
+    }
+
+    const Segment *child = Cursor_child(c, f);
+    if (Segment_is_text(child)) {
+      c->text_off = 0;
+      return true;
+    }
+
+    CursorFrame next = {
+        .seg = child,
+        .rep = 0,
+        .child = 0,
+    };
+    c->stack[c->depth++] = next;
+  }
+}
+
+// Move on to the next text segment, in order of the decompressed output
+static void Cursor_advance(Cursor *c) {
+  c->stack[c->depth - 1].child++;
+
+  while (c->depth > 0) {
+    if (Cursor_descend(c)) {
+      return;
+    }
+
+    // Out of children: next repetition, or back up a level
+    CursorFrame *f = &c->stack[c->depth - 1];
+    f->rep++;
+    if (f->rep < f->seg->repeat) {
+      f->child = 0;
+      continue;
+    }
+
+    c->depth--;
+    if (c->depth > 0) {
+      c->stack[c->depth - 1].child++;
+    }
+  }
+}
+
+// Cursor at `offset` of the decompressed output (at the end if past it), in
+// O(depth * log(children))
+static Cursor DecompressedIndex_seek(const DecompressedIndex *ix,
+                                     CursorFrame *stack, u128 offset) {
+  Cursor c = {
+      .ix = ix,
+      .stack = stack,
+      .depth = 0,
+  };
+
+  if (offset >= ix->root.weight) {
+    return c;
+  }
+
+  const Segment *seg = &ix->root;
+  while (true) {
+    u128 unit = Segment_unit(seg);
+    u64 rep = (u64)u128_divmod(offset, unit, &offset);
+
+    // Last child starting at or before offset
+    u64 lo = 0;
+    u64 hi = seg->count;
+    while (hi - lo > 1) {
+      u64 mid = lo + (hi - lo) / 2;
+      if (ix->segments[seg->first + mid].start <= offset) {
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+    }
+
+    CursorFrame f = {
+        .seg = seg,
+        .rep = rep,
+        .child = lo,
+    };
+    c.stack[c.depth++] = f;
+
+    const Segment *child = &ix->segments[seg->first + lo];
+    offset -= child->start;
+
+    if (Segment_is_text(child)) {
+      c.text_off = (u64)offset;
+      return c;
+    }
+    seg = child;
+  }
+}
+
+// Returns the number of bytes read, less than len only at the end
+static usize Cursor_read(Cursor *c, u8 *buf, usize len) {
+  usize written = 0;
+
+  while (written < len && c->depth > 0) {
+    const Segment *text = Cursor_child(c, &c->stack[c->depth - 1]);
+    u64 available = (u64)text->weight - c->text_off;
+    usize n = len - written < available ? len - written : available;
+
+    memcpy(&buf[written], &c->ix->input.dat[text->first + c->text_off], n);
+    written += n;
+    c->text_off += n;
+
+    if (c->text_off == text->weight) {
+      Cursor_advance(c);
+    }
+  }
+
+  return written;
+}
+
+#define STREAM_BUF_SIZE (1024 * 1024)
+
+// `day09 [file|-] [read <offset> <len> | cat]`: "-" streams the compressed data
+// from stdin, read prints a range of the decompressed data and cat all of it
+// (both need a file to index)
+static void decompress(const Cli *cli, const char *path) {
+  Span input = Span_from_file(path);
+  DecompressedIndex ix = DecompressedIndex_build(input);
+  CursorFrame *stack =
+      (CursorFrame *)calloc(ix.max_depth + 1, sizeof(CursorFrame));
+
+  u128 offset = 0;
+  u128 len = ix.root.weight;
+
+  if (streq(cli->mode, "read")) {
+    assert(cli->mode_args_len == 2);
+    offset = UNWRAP(Span_parse_u64(Span_from_str(cli->mode_args[0]), 10)).fst;
+    len = UNWRAP(Span_parse_u64(Span_from_str(cli->mode_args[1]), 10)).fst;
+  } else {
+    assert(cli->mode_args_len == 0);
+  }
+
+  Cursor c = DecompressedIndex_seek(&ix, stack, offset);
+  u8 *buf = (u8 *)calloc(1, STREAM_BUF_SIZE);
+
+  while (len > 0) {
+    usize n = Cursor_read(&c, buf, len < STREAM_BUF_SIZE ? (usize)len
+                                                          : STREAM_BUF_SIZE);
+    if (n == 0) {
+      break;
+    }
+    sys_write(STDOUT, buf, n);
+    len -= n;
+  }
+  putchar('\n');
+}
+
+int main(void) {
+  const char *modes[] = {"read", "cat"};
+  Cli cli = Cli_parse(modes, 2, NULL, 0);
+  const char *path = cli.path != NULL ? cli.path : "inputs/day09.txt";
+  bool streaming = streq(path, "-");
+
+  if (cli.mode != NULL) {
+    if (streaming) {
+      panic("read and cat need a file\n");
+    }
+    decompress(&cli, path);
+    return 0;
+  }
+
+  Decompressor part1 = Decompressor_mk(false);
+  Decompressor part2 = Decompressor_mk(true);
+
+  if (streaming) {
+    u8 *buf = (u8 *)calloc(1, STREAM_BUF_SIZE);
+
+    while (true) {
+      isize n = sys_read(STDIN, buf, STREAM_BUF_SIZE);
+      assert(n >= 0);
+      if (n == 0) {
+        break;
+      }
+
+      Span chunk = {
+          .dat = buf,
+          .len = (usize)n,
+      };
+      Decompressor_feed(&part1, chunk);
+      Decompressor_feed(&part2, chunk);
+    }
+
+    print_totals(&part1, &part2);
+    return 0;
+  }
+
+  Span input = Span_from_file(path);
+  Decompressor_feed(&part1, input);
+  Decompressor_feed(&part2, input);
+  print_totals(&part1, &part2);
 
   return 0;
 }
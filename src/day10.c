@@ -1,174 +1,350 @@
 #include "baz.h"
 
-define_array(Chips, u8, 8);
-define_array(GivingBots, u8, 128);
+// Bots and outputs are both nodes of the factory: bots first, then outputs.
+// While parsing (before the number of bots is known) outputs are tagged.
+#define OUTPUT_TAG 0x80000000u
+#define NO_TARGET UINT32_MAX
 
 typedef struct {
-  u8 low;
-  u8 high;
-  bool low_output;  // as opposed to a bot
-  bool high_output; // as opposed to a bot
-} Instr;
-
-void solve(Span input) {
-  GivingBots giving_bots = {0};
-  Chips output_chips[256] = {0};
-  Chips bot_chips[256] = {0};
-  Instr bot_instrs[256] = {0};
-
-  SpanSplitIterator line_it = {
-      .rest = input,
-      .sep = (u8)'\n',
+  u32 value;
+  u32 bot;
+} Value;
+
+typedef struct {
+  u32 bot;
+  u32 low;
+  u32 high;
+} Rule;
+
+typedef struct {
+  Value *values;
+  usize values_len;
+  Rule *rules;
+  usize rules_len;
+  u32 bots;    // max bot id + 1
+  u32 outputs; // max output id + 1
+} Network;
+
+static u32 parse_id(Span *instr) {
+  SpanParseU64 res = Span_parse_u64(*instr, 10);
+  assert(res.valid);
+  *instr = res.dat.snd;
+  return u64_to_u32(res.dat.fst);
+}
+
+static u32 parse_target(Network *net, Span *instr) {
+  Span bot_span = Span_from_str("bot ");
+  Span output_span = Span_from_str("output ");
+
+  if (Span_starts_with(*instr, bot_span)) {
+    *instr = Span_slice(*instr, bot_span.len, instr->len);
+    u32 bot = parse_id(instr);
+    net->bots = bot >= net->bots ? bot + 1 : net->bots;
+    return bot;
+  }
+
+  if (Span_starts_with(*instr, output_span)) {
+    *instr = Span_slice(*instr, output_span.len, instr->len);
+    u32 output = parse_id(instr);
+    assert(output < OUTPUT_TAG);
+    net->outputs = output >= net->outputs ? output + 1 : net->outputs;
+    return output | OUTPUT_TAG;
+  }
+
+  panic("Unexpected\n");
+}
+
+static Network Network_parse(Span input) {
+  // The shortest line is "value 1 goes to bot 1"
+  usize max_lines = input.len / 21 + 1;
+
+  Network net = {
+      .values = (Value *)calloc(max_lines, sizeof(Value)),
+      .rules = (Rule *)calloc(max_lines, sizeof(Rule)),
   };
 
+  SpanSplitIterator line_it = Span_split_lines(input);
+
   SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
   while (line.valid) {
     Span value_span = Span_from_str("value ");
     Span bot_span = Span_from_str("bot ");
-    Span output_span = Span_from_str("output ");
 
-    if (Span_starts_with(line.dat, value_span)) {
+    if (line.dat.len == 0) {
+      // Skip blank lines
+    } else if (Span_starts_with(line.dat, value_span)) {
       Span instr = Span_slice(line.dat, value_span.len, line.dat.len);
 
-      SpanParseU64 res_value = Span_parse_u64(instr, 10);
-      assert(res_value.valid);
-      u8 value = u64_to_u8(res_value.dat.fst);
-
-      instr =
-          Span_trim_start(res_value.dat.snd, Span_from_str(" goes to bot "));
+      Value value;
+      value.value = parse_id(&instr);
+      instr = Span_trim_start(instr, Span_from_str(" goes to "));
+      value.bot = parse_target(&net, &instr);
+      assert((value.bot & OUTPUT_TAG) == 0);
 
-      SpanParseU64 res_bot = Span_parse_u64(instr, 10);
-      assert(res_bot.valid);
-      u8 bot = u64_to_u8(res_bot.dat.fst);
-
-      Chips_push(&bot_chips[bot], value);
-      if (bot_chips[bot].len == 2) {
-        GivingBots_push(&giving_bots, bot);
-      }
+      net.values[net.values_len++] = value;
 
     } else if (Span_starts_with(line.dat, bot_span)) {
       Span instr = Span_slice(line.dat, bot_span.len, line.dat.len);
 
-      SpanParseU64 res_bot = Span_parse_u64(instr, 10);
-      assert(res_bot.valid);
-      u8 bot = u64_to_u8(res_bot.dat.fst);
+      Rule rule;
+      rule.bot = parse_id(&instr);
+      net.bots = rule.bot >= net.bots ? rule.bot + 1 : net.bots;
 
-      instr = Span_trim_start(res_bot.dat.snd, Span_from_str(" gives low to "));
+      instr = Span_trim_start(instr, Span_from_str(" gives low to "));
+      rule.low = parse_target(&net, &instr);
 
-      bool low_output;
+      instr = Span_trim_start(instr, Span_from_str(" and high to "));
+      rule.high = parse_target(&net, &instr);
 
-      if (Span_starts_with(instr, bot_span)) {
-        instr = Span_slice(instr, bot_span.len, instr.len);
-        low_output = false;
-      } else if (Span_starts_with(instr, output_span)) {
-        instr = Span_slice(instr, output_span.len, instr.len);
-        low_output = true;
-      } else {
-        panic("Unexpected\n");
-      }
+      net.rules[net.rules_len++] = rule;
+    } else {
+      panic("Unexpected\n");
+    }
 
-      SpanParseU64 res_low = Span_parse_u64(instr, 10);
-      assert(res_low.valid);
-      u8 low = u64_to_u8(res_low.dat.fst);
+    line = SpanSplitIterator_next(&line_it);
+  }
 
-      instr = Span_trim_start(res_low.dat.snd, Span_from_str(" and high to "));
+  return net;
+}
 
-      bool high_output;
+// Wiring in compressed sparse row form: every node gets exactly as many chip
+// slots as chips can ever be given to it (its in-degree), in one flat array.
+typedef struct {
+  u32 bots;
+  u32 nodes;
+  u32 *low;      // per bot, node receiving the low chip
+  u32 *high;     // per bot, node receiving the high chip
+  u32 *start;    // nodes + 1, slots of node n are [start[n], start[n + 1])
+  u32 *received; // per node
+  u32 *slots;
+} Factory;
+
+static inline u32 Factory_node(const Factory *f, u32 target) {
+  return (target & OUTPUT_TAG) ? f->bots + (target & ~OUTPUT_TAG) : target;
+}
 
-      if (Span_starts_with(instr, bot_span)) {
-        instr = Span_slice(instr, bot_span.len, instr.len);
-        high_output = false;
-      } else if (Span_starts_with(instr, output_span)) {
-        instr = Span_slice(instr, output_span.len, instr.len);
-        high_output = true;
-      } else {
-        panic("Unexpected\n");
-      }
+static Factory Factory_mk(const Network *net) {
+  u32 bots = net->bots;
+  Factory f = {
+      .bots = bots,
+      .nodes = CHECKED_ADD(bots, net->outputs),
+  };
 
-      SpanParseU64 res_high = Span_parse_u64(instr, 10);
-      assert(res_high.valid);
-      u8 high = u64_to_u8(res_high.dat.fst);
+  f.low = (u32 *)calloc(f.bots, sizeof(u32));
+  f.high = (u32 *)calloc(f.bots, sizeof(u32));
+  f.start = (u32 *)calloc((usize)f.nodes + 1, sizeof(u32));
+  f.received = (u32 *)calloc(f.nodes, sizeof(u32));
 
-      Instr bot_instr = {
-          .low = low,
-          .high = high,
-          .low_output = low_output,
-          .high_output = high_output,
-      };
+  for (u32 b = 0; b < f.bots; b++) {
+    f.low[b] = NO_TARGET;
+    f.high[b] = NO_TARGET;
+  }
 
-      bot_instrs[bot] = bot_instr;
-    } else {
-      panic("Unexpected\n");
-    }
+  // In-degrees, shifted by one so the prefix sum gives the starts
+  for (usize i = 0; i < net->values_len; i++) {
+    f.start[net->values[i].bot + 1]++;
+  }
 
-    line = SpanSplitIterator_next(&line_it);
+  for (usize i = 0; i < net->rules_len; i++) {
+    Rule rule = net->rules[i];
+    assert(f.low[rule.bot] == NO_TARGET); // One rule per bot
+
+    f.low[rule.bot] = Factory_node(&f, rule.low);
+    f.high[rule.bot] = Factory_node(&f, rule.high);
+    f.start[f.low[rule.bot] + 1]++;
+    f.start[f.high[rule.bot] + 1]++;
   }
 
-  while (giving_bots.len > 0) {
-    GivingBotsPop next = GivingBots_pop(&giving_bots);
-    assert(next.valid);
+  for (u32 n = 0; n < f.nodes; n++) {
+    f.start[n + 1] = CHECKED_ADD(f.start[n + 1], f.start[n]);
+  }
 
-    u8 bot = next.dat;
-    Instr instr = bot_instrs[bot];
+  f.slots = (u32 *)calloc((usize)f.start[f.nodes] + 1, sizeof(u32));
 
-    ChipsPop a = Chips_pop(&bot_chips[bot]);
-    assert(a.valid);
+  return f;
+}
 
-    ChipsPop b = Chips_pop(&bot_chips[bot]);
-    assert(b.valid);
+// Comparisons asked about, as sorted `low << 32 | high` keys
+typedef struct {
+  u64 *keys;
+  u32 *bots; // answers, NO_TARGET until seen
+  usize len;
+} Queries;
+
+static inline u64 query_key(u32 a, u32 b) {
+  u32 low = a < b ? a : b;
+  u32 high = a < b ? b : a;
+  return (u64)low << 32 | high;
+}
 
-    if (bot_chips[bot].len >= 2) {
-      // Add it back into the queue
-      GivingBots_push(&giving_bots, bot);
+// Index of key, or len when it wasn't asked about
+static usize Queries_find(const Queries *q, u64 key) {
+  usize lo = 0;
+  usize hi = q->len;
+  while (lo < hi) {
+    usize mid = lo + (hi - lo) / 2;
+    if (q->keys[mid] < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
     }
+  }
 
-    u8 low = a.dat < b.dat ? a.dat : b.dat;
-    u8 high = b.dat < a.dat ? a.dat : b.dat;
-
-    if (high == 61 && low == 17) {
-      String out = {0};
-      String_push_str(&out, "Bot [");
-      String_push_u64(&out, bot, 10);
-      String_push_str(&out, "]: Low: ");
-      String_push_u64(&out, low, 10);
-      String_push_str(&out, " | High: ");
-      String_push_u64(&out, high, 10);
-      String_println(&out);
-    }
+  return lo < q->len && q->keys[lo] == key ? lo : q->len;
+}
 
-    if (instr.low_output) {
-      Chips_push(&output_chips[instr.low], low);
-    } else {
-      Chips_push(&bot_chips[instr.low], low);
+static Queries Queries_mk(u64 *keys, usize len, Arena *scratch) {
+  radix_sort_u64(keys, len, scratch);
 
-      if (bot_chips[instr.low].len == 2) {
-        GivingBots_push(&giving_bots, instr.low);
-      }
+  usize unique = 0;
+  for (usize i = 0; i < len; i++) {
+    if (unique == 0 || keys[unique - 1] != keys[i]) {
+      keys[unique++] = keys[i];
     }
+  }
 
-    if (instr.high_output) {
-      Chips_push(&output_chips[instr.high], high);
-    } else {
-      Chips_push(&bot_chips[instr.high], high);
+  Queries q = {
+      .keys = keys,
+      .bots = (u32 *)calloc(unique + 1, sizeof(u32)),
+      .len = unique,
+  };
+
+  for (usize i = 0; i < unique; i++) {
+    q.bots[i] = NO_TARGET;
+  }
+
+  return q;
+}
+
+// A bot fires each time it holds a pair of chips, worklist entries are
+// `bot << 32 | slot of the first chip of the pair`
+static inline void Factory_give(Factory *f, u64 *worklist, usize *worklist_len,
+                                u32 node, u32 chip) {
+  u32 slot = f->start[node] + f->received[node]++;
+  assert(slot < f->start[node + 1]);
+  f->slots[slot] = chip;
+
+  if (node < f->bots && (f->received[node] & 1) == 0) {
+    worklist[(*worklist_len)++] = (u64)node << 32 | (slot - 1);
+  }
+}
+
+static void Factory_run(Factory *f, const Network *net, Queries *q) {
+  // At most one entry per pair of slots
+  usize capacity = (usize)f->start[f->nodes] / 2 + 1;
+  u64 *worklist = (u64 *)calloc(capacity, sizeof(u64));
+  usize worklist_len = 0;
+
+  for (usize i = 0; i < net->values_len; i++) {
+    Value v = net->values[i];
+    Factory_give(f, worklist, &worklist_len, v.bot, v.value);
+  }
+
+  while (worklist_len > 0) {
+    u64 next = worklist[--worklist_len];
+    u32 bot = (u32)(next >> 32);
+    u32 slot = (u32)next;
+
+    u32 a = f->slots[slot];
+    u32 b = f->slots[slot + 1];
+    u32 low = a < b ? a : b;
+    u32 high = a < b ? b : a;
+
+    if (f->low[bot] == NO_TARGET) {
+      panic("Bot without instructions\n");
+    }
 
-      if (bot_chips[instr.high].len == 2) {
-        GivingBots_push(&giving_bots, instr.high);
+    if (q->len > 0) {
+      usize ix = Queries_find(q, (u64)low << 32 | high);
+      if (ix < q->len && q->bots[ix] == NO_TARGET) {
+        q->bots[ix] = bot;
       }
     }
+
+    Factory_give(f, worklist, &worklist_len, f->low[bot], low);
+    Factory_give(f, worklist, &worklist_len, f->high[bot], high);
+  }
+
+  free(worklist);
+}
+
+// First chip given to an output
+static u64 Factory_output(const Factory *f, u32 output) {
+  u32 node = f->bots + output;
+  assert(node < f->nodes && f->received[node] > 0);
+  return f->slots[f->start[node]];
+}
+
+static void print_answer(const Queries *q, u32 a, u32 b) {
+  u64 key = query_key(a, b);
+  usize ix = Queries_find(q, key);
+  assert(ix < q->len);
+
+  String out = {0};
+  if (q->bots[ix] == NO_TARGET) {
+    String_push_str(&out, "No bot compares ");
+    String_push_u64(&out, key >> 32, 10);
+    String_push_str(&out, " and ");
+    String_push_u64(&out, key & UINT32_MAX, 10);
+  } else {
+    String_push_str(&out, "Bot [");
+    String_push_u64(&out, q->bots[ix], 10);
+    String_push_str(&out, "]: Low: ");
+    String_push_u64(&out, key >> 32, 10);
+    String_push_str(&out, " | High: ");
+    String_push_u64(&out, key & UINT32_MAX, 10);
+  }
+  String_println(&out);
+}
+
+// `pairs` holds pairs_len (a, b) chip values to find the comparing bot of
+void solve(Span input, const u32 *pairs, usize pairs_len) {
+  Network net = Network_parse(input);
+  Factory f = Factory_mk(&net);
+
+  Arena scratch = Arena_mk(pairs_len * 2 * sizeof(u64) + 4096);
+  u64 *keys = ARENA_PUSH(&scratch, u64, pairs_len);
+  for (usize i = 0; i < pairs_len; i++) {
+    keys[i] = query_key(pairs[2 * i], pairs[2 * i + 1]);
+  }
+  Queries q = Queries_mk(keys, pairs_len, &scratch);
+
+  Factory_run(&f, &net, &q);
+
+  for (usize i = 0; i < pairs_len; i++) {
+    print_answer(&q, pairs[2 * i], pairs[2 * i + 1]);
   }
 
   String out = {0};
   String_push_u64(&out,
-                  (usize)output_chips[0].dat[0] *
-                      (usize)output_chips[1].dat[0] *
-                      (usize)output_chips[2].dat[0],
+                  Factory_output(&f, 0) * Factory_output(&f, 1) *
+                      Factory_output(&f, 2),
                   10);
   String_println(&out);
 }
 
+// `day10 [file] [compare <a> <b>...]`: find the bot comparing each pair of
+// chips, 61 and 17 by default
 int main(void) {
-  Span input = Span_from_file("inputs/day10.txt");
-  solve(input);
+  const char *modes[] = {"compare"};
+  Cli cli = Cli_parse(modes, 1, NULL, 0);
+  Span input = Span_from_file(cli.path != NULL ? cli.path : "inputs/day10.txt");
+
+  if (cli.mode == NULL) {
+    u32 pairs[2] = {61, 17};
+    solve(input, pairs, 1);
+    return 0;
+  }
+
+  assert(cli.mode_args_len > 0 && cli.mode_args_len % 2 == 0);
+  usize pairs_len = cli.mode_args_len / 2;
+  u32 *pairs = (u32 *)calloc(pairs_len * 2, sizeof(u32));
+  for (usize i = 0; i < pairs_len * 2; i++) {
+    Span arg = Span_from_str(cli.mode_args[i]);
+    pairs[i] = u64_to_u32(UNWRAP(Span_parse_u64(arg, 10)).fst);
+  }
+
+  solve(input, pairs, pairs_len);
 
   return 0;
 }
@@ -1,68 +1,53 @@
 #include "baz.h"
 
-typedef u8 Item; // More like a u4
+typedef u8 Item; // Element id and a generator bit
+
+#define ELEMENTS_MAX 32
 
 static inline Item Item_mk(u8 id, bool generator) {
-  assert(id < 8);
-  return (Item)(id | ((u8)generator << 3));
+  assert(id < ELEMENTS_MAX);
+  return (Item)(id | ((u8)generator << 5));
 }
 
-static inline bool Item_generator(Item x) { return (bool)((x >> 3) & 1); }
+static inline bool Item_generator(Item x) { return (bool)((x >> 5) & 1); }
 
-static inline u8 Item_id(Item x) { return x & 7; }
+static inline u8 Item_id(Item x) { return x & (ELEMENTS_MAX - 1); }
 
-static void Item_print(Item item) {
-  u8 id = to_upper(Item_id(item) + 'a');
-  putchar(id);
-  putchar(Item_generator(item) ? 'G' : 'M');
-}
+// Elements interned by full name ("plutonium" and "promethium" are different
+// elements)
+static Span names[ELEMENTS_MAX] = {0};
+static u8 names_len = 0;
+
+static u8 get_id(Span name) {
+  for (u8 id = 0; id < names_len; id++) {
+    if (Span_eq(&names[id], &name)) {
+      return id;
+    }
+  }
 
-static inline bool Item_eq(Item a, Item b) {
-  return Item_generator(a) == Item_generator(b) && Item_id(a) == Item_id(b);
+  assert(names_len < ELEMENTS_MAX);
+  names[names_len] = name;
+  return names_len++;
 }
 
-static bool Item_mix(Item a, Item b) {
-  return Item_generator(a) != Item_generator(b) && Item_id(a) != Item_id(b);
+// First two letters of the element: ThG, PlM, ...
+static void Item_print(Item item) {
+  Span name = names[Item_id(item)];
+  putchar(to_upper(name.dat[0]));
+  if (name.len > 1) {
+    putchar(name.dat[1]);
+  }
+  putchar(Item_generator(item) ? 'G' : 'M');
 }
 
-define_bit_set(FloorState, u16, 1);
+// Microchips in the low 32 bits, generators in the high 32 bits
+define_bit_set(FloorState, u64, 1);
 
 typedef struct {
   FloorState floors[4];
   u8 elevator;
 } State;
 
-static Hash State_hash(const State *s) {
-  FxHasher hasher = {0};
-  FxHasher_add(&hasher, s->elevator);
-  for (usize i = 0; i < 4; i++) {
-    FxHasher_add(&hasher, s->floors[i].dat[0]);
-  }
-  return hasher;
-}
-
-static inline bool State_eq(const State *a, const State *b) {
-  return a->elevator == b->elevator &&
-         a->floors[0].dat[0] == b->floors[0].dat[0] &&
-         a->floors[1].dat[0] == b->floors[1].dat[0] &&
-         a->floors[2].dat[0] == b->floors[2].dat[0] &&
-         a->floors[3].dat[0] == b->floors[3].dat[0];
-}
-
-static int State_cmp(const State *a, const State *b) {
-  for (int i = 3; i >= 0; i--) {
-    usize a_count = FloorState_count(a->floors[i]);
-    usize b_count = FloorState_count(b->floors[i]);
-    int cmp = usize_cmp(&a_count, &b_count);
-
-    if (cmp != 0) {
-      return cmp;
-    }
-  }
-
-  return 0;
-}
-
 static void State_print(const State *state) {
   String out = {0};
   for (int i = 3; i >= 0; i--) {
@@ -88,20 +73,6 @@ static void State_print(const State *state) {
   }
 }
 
-static u8 ids[26] = {0};
-static u8 next_id = 1;
-
-static u8 get_id(u8 c) {
-  u8 id = c - 'a';
-
-  if (ids[id] == 0) {
-    ids[id] = next_id;
-    next_id++;
-  }
-
-  return ids[id];
-}
-
 static State State_parse(Span input) {
   State state = {0};
 
@@ -141,7 +112,9 @@ static State State_parse(Span input) {
       SpanSplitIteratorNext type = SpanSplitIterator_next(&word_it);
       SpanSplitIteratorNext gen = SpanSplitIterator_next(&word_it);
 
-      u8 id = get_id(type.dat.dat[0]);
+      // "thulium generator" or "thulium-compatible microchip"
+      SpanSplitOn name = Span_split_on((u8)'-', type.dat);
+      u8 id = get_id(name.valid ? name.dat.fst : type.dat);
 
       Item item = Item_mk(id, gen.dat.dat[0] == 'g');
       FloorState_insert(&state.floors[floor_ix], item);
@@ -156,207 +129,1286 @@ static State State_parse(Span input) {
   return state;
 }
 
-static bool State_is_goal(const State *state) {
-  for (u8 i = 0; i < 3; i++) {
-    if (FloorState_count(state->floors[i]) > 0) {
-      return false;
+static u64 binomial[48][48] = {0};
+
+static void binomial_init(void) {
+  for (usize n = 0; n < 48; n++) {
+    binomial[n][0] = 1;
+    for (usize k = 1; k <= n; k++) {
+      binomial[n][k] = binomial[n - 1][k - 1] + binomial[n - 1][k];
     }
   }
+}
 
-  return true;
+static usize State_pairs(const State *state) {
+  usize items = 0;
+  for (usize i = 0; i < 4; i++) {
+    items += FloorState_count(state->floors[i]);
+  }
+  return items / 2;
 }
 
-define_array(MoveItems, Item, 2);
+// Number of canonical states for that many pairs
+static inline u64 rank_count(usize pairs) {
+  assert(pairs <= ELEMENTS_MAX);
+  return 4 * binomial[pairs + 15][pairs];
+}
 
-typedef struct {
-  MoveItems items;
-  bool up;
-} Move;
+// Elements are interchangeable: states which only differ by a permutation of
+// the elements are the same. A state is canonically the multiset of its
+// (generator floor, chip floor) pairs (16 kinds) and the elevator, which is
+// perfectly ranked into the key: sorted pairs p_0 <= .. <= p_{n-1} map to a
+// strictly increasing c_i = p_i + i, ranked in the combinatorial number system
+// as sum(binomial(c_i, i + 1)). There are binomial(n + 15, n) multisets, times
+// 4 elevator floors, which fits in a u64 for up to 32 pairs.
+static u64 State_key(const State *state) {
+  u64 rank = 0;
+  usize i = 0;
+
+  for (u32 g = 0; g < 4; g++) {
+    u64 generators = state->floors[g].dat[0] >> 32;
+    for (u32 c = 0; c < 4; c++) {
+      u64 microchips = state->floors[c].dat[0] & 0xFFFFFFFF;
+      usize count = (usize)__builtin_popcountl(generators & microchips);
+
+      for (usize k = 0; k < count; k++, i++) {
+        rank += binomial[(g << 2 | c) + i][i + 1];
+      }
+    }
+  }
+
+  return state->elevator * binomial[i + 15][i] + rank;
+}
 
-static bool valid_floor(FloorState floor) {
-  // generator use the top 8 bits of u16
-  FloorState generators = floor;
-  generators.dat[0] >>= 8;
+// A representative of the canonical state, elements are numbered in order
+static State State_from_key(u64 key, usize pairs) {
+  u64 multisets = binomial[pairs + 15][pairs];
+  State state = {
+      .elevator = (u8)(key / multisets),
+  };
+  u64 rank = key % multisets;
+
+  usize c = pairs + 15;
+  for (usize i = pairs; i-- > 0;) {
+    // Largest c with binomial(c, i + 1) <= rank
+    do {
+      c--;
+    } while (binomial[c][i + 1] > rank);
+    rank -= binomial[c][i + 1];
+
+    usize p = c - i;
+    FloorState_insert(&state.floors[p >> 2], Item_mk((u8)i, true));
+    FloorState_insert(&state.floors[p & 3], Item_mk((u8)i, false));
+  }
 
-  FloorState microchips = floor;
-  microchips.dat[0] &= 0xFF;
+  return state;
+}
 
-  return FloorState_is_subset(generators, microchips) ||
-         FloorState_is_subset(microchips, generators);
+// Everything on the top floor
+static State State_goal(const State *state) {
+  State goal = {
+      .elevator = 3,
+  };
+  for (usize i = 0; i < 4; i++) {
+    goal.floors[3] = FloorState_union(goal.floors[3], state->floors[i]);
+  }
+  return goal;
 }
 
-static bool try_move(const State *state, State *out, Move move) {
-  memset(out, 0, sizeof(State));
+static bool State_is_goal(const State *state) {
+  for (u8 i = 0; i < 3; i++) {
+    if (FloorState_count(state->floors[i]) > 0) {
+      return false;
+    }
+  }
 
-  // Needs at least one item in the elevator
-  if (move.items.len == 0) {
-    return false;
+  return true;
+}
+
+// Greedy priority: the more items on the upper floors the better. Lower is
+// better, ordered by item count on the top floor, then the one below, etc.
+static usize State_greedy_rank(const State *state) {
+  usize rank = 0;
+  for (int i = 3; i >= 0; i--) {
+    rank = rank << 7 | (64 - FloorState_count(state->floors[i]));
   }
+  return rank;
+}
 
-  if (move.items.len == 2) {
-    // Can't mix generators and microchips of different types in elevator
-    if (Item_mix(move.items.dat[0], move.items.dat[1])) {
-      return false;
+// Admissible bound on the moves left. Every move crosses exactly one of the 3
+// boundaries between floors, and the k items at or below a boundary all have
+// to cross it: at most 2 go up per trip and every trip down but the last has
+// to bring at least one back. That is 2k - 3 crossings (1 for k = 1) when the
+// elevator is below the boundary, and 2k when it has to come down first.
+static usize State_lower_bound(const State *state) {
+  usize bound = 0;
+  usize k = 0;
+
+  for (u8 b = 0; b < 3; b++) {
+    k += FloorState_count(state->floors[b]);
+
+    if (k == 0) {
+      continue;
     }
 
-    // Can't move twice the same item
-    if (Item_eq(move.items.dat[0], move.items.dat[1])) {
-      return false;
+    if (state->elevator > b) {
+      bound += 2 * k;
+    } else {
+      bound += k == 1 ? 1 : 2 * k - 3;
     }
   }
 
-  // Can't move up from floor 4 (ix 3) or down from floor 1 (ix 0)
-  if ((state->elevator == 3 && move.up) || (state->elevator == 0 && !move.up)) {
+  return bound;
+}
+
+// A floor is fine without generators, or when every microchip has its
+// generator. Checks 4 floor masks at once.
+static inline bool valid_floors(u64x4 floors) {
+  u64x4 generators = floors >> 32;
+  u64x4 microchips = floors & 0xFFFFFFFF;
+  u64x4 fried = (u64x4)((generators != 0) & ((microchips & ~generators) != 0));
+  return u32x8_movemask((u32x8)fried) == 0;
+}
+
+// Move one or two items (the `items` mask), returns if it was valid
+static inline bool State_move(const State *state, State *out, u64 items,
+                              int target) {
+  u64 current = state->floors[state->elevator].dat[0];
+  u64 dest = state->floors[target].dat[0];
+
+  u64x4 floors = {items, current ^ items, dest | items, 0};
+  if (!valid_floors(floors)) {
     return false;
   }
 
-  out->elevator = move.up ? state->elevator + 1 : state->elevator - 1;
-
-  // Copy state with item move
-  for (usize i = 0; i < 4; i++) {
-    out->floors[i] = state->floors[i];
+  *out = *state;
+  out->floors[state->elevator].dat[0] = current ^ items;
+  out->floors[target].dat[0] = dest | items;
+  out->elevator = (u8)target;
+  return true;
+}
 
-    if (i == state->elevator) {
-      FloorState_remove(&out->floors[i], move.items.dat[0]);
-      if (move.items.len == 2) {
-        FloorState_remove(&out->floors[i], move.items.dat[1]);
-      }
+// All the states reachable in one move, returns how many. The one or two
+// items taken are picked among the occupied bits of the floor with pdep, the
+// elevator itself follows the same rule as a floor (no chip with a foreign
+// generator).
+#define NEXT_MAX (FloorState_size * (FloorState_size + 1))
+static usize State_next(const State *state, State *next) {
+  usize len = 0;
+  u64 current = state->floors[state->elevator].dat[0];
+  u32 count = (u32)__builtin_popcountl(current);
+
+  for (int dir = -1; dir <= 1; dir += 2) {
+    int target = state->elevator + dir;
+    if (target < 0 || target > 3) {
+      continue;
     }
 
-    if (i == out->elevator) {
-      FloorState_insert(&out->floors[i], move.items.dat[0]);
-      if (move.items.len == 2) {
-        FloorState_insert(&out->floors[i], move.items.dat[1]);
+    // Going up pairs come first, going down single items do (the paths
+    // printed depend on this order)
+    bool up = dir > 0;
+    for (usize pass = 0; pass < 2; pass++) {
+      bool pairs = (pass == 0) == up;
+
+      for (u32 i = 0; i < count; i++) {
+        for (u32 j = pairs ? i + 1 : i; j < (pairs ? count : i + 1); j++) {
+          u64 items = __builtin_ia32_pdep_di(1ul << i | 1ul << j, current);
+          len += State_move(state, &next[len], items, target);
+        }
       }
     }
   }
 
-  // Can't mix generators and microchips of different types on new floor or old
-  // floor
-  if (!valid_floor(out->floors[out->elevator]) ||
-      !valid_floor(out->floors[state->elevator])) {
-    return false;
-  };
+  return len;
+}
 
-  return true;
+// Packed parent record: moves in the top 24 bits, ix of the parent in the
+// hashmap (which is append only, so the ix is stable) in the low 40 bits
+typedef u64 Step;
+
+#define STEP_IX_BITS 40
+#define STEP_UNREACHED UINT64_MAX // More moves than any real Step
+
+static inline Step Step_mk(usize moves, usize from_ix) {
+  assert(moves < (1ul << (64 - STEP_IX_BITS)) - 1);
+  assert(from_ix < (1ul << STEP_IX_BITS));
+  return moves << STEP_IX_BITS | from_ix;
 }
 
-typedef struct {
-  usize moves;
-  usize from_ix; // ix in hashmap (which is append only, so the ix is stable)
-  Move move;
-} Step;
+static inline usize Step_moves(Step step) { return step >> STEP_IX_BITS; }
+
+static inline usize Step_from(Step step) {
+  return step & ((1ul << STEP_IX_BITS) - 1);
+}
 
 typedef struct {
   usize moves;
-  State state;
+  usize f; // Priority, lowest first: moves + lower bound for A*
+  u64 key; // State_key, expanded from the representative state
 } MoveState;
 
 static int MoveState_cmp(const MoveState *a, const MoveState *b) {
-  // usize a_moves = a->moves;
-  // usize b_moves = b->moves;
-  // int cmp = usize_cmp(&a_moves, &b_moves);
-
-  // if (cmp != 0) {
-  //   return -cmp;
-  // }
+  int cmp = usize_cmp(&a->f, &b->f);
+  if (cmp != 0) {
+    return -cmp;
+  }
 
-  return State_cmp(&a->state, &b->state);
+  // Deepest first on ties, it is closer to a goal
+  return usize_cmp(&a->moves, &b->moves);
 }
 
-#define STATE_COUNT (100 * 1024 * 1024)
+// Canonical states make for a much smaller state space (700K for 7 elements,
+// 13M for 10 but A* only sees a small fraction)
+#define STATE_COUNT (16 * 1024 * 1024)
 define_binary_heap(PQ, MoveState, STATE_COUNT, MoveState_cmp);
-define_hash_map(BestMoves, State, Step, STATE_COUNT, State_hash, State_eq);
+define_hash_map(BestMoves, u64, Step, STATE_COUNT, usize_hash, usize_eq);
+
+typedef enum {
+  SEARCH_GREEDY, // ordered by State_greedy_rank, needs re-expansions
+  SEARCH_ASTAR,
+  SEARCH_BIDIR,  // BFS from both ends, meeting in the middle
+  SEARCH_RANKED,   // BFS over state ranks, no hashing
+  SEARCH_PARALLEL, // Same on several threads, a level at a time
+  SEARCH_EXTERNAL, // BFS with the levels in sorted files
+  SEARCH_MODES,
+} SearchMode;
+
+static const char *search_names[] = {"greedy",   "astar",   "bidir",
+                                     "ranked",   "parallel", "external"};
+
+typedef struct {
+  usize moves;
+  usize expanded;
+} SearchResult;
 
-static void print_steps(const BestMoves *bm, usize ix) {
+// Keys from the start to ix (included), returns how many
+static usize path_keys(const BestMoves *bm, usize ix, u64 *keys) {
+  usize len = Step_moves(bm->values[ix]) + 1;
 
-  Step step = bm->values[ix];
-  if (step.moves > 1) {
-    print_steps(bm, step.from_ix);
+  for (usize i = len; i-- > 0;) {
+    keys[i] = bm->keys[ix];
+    ix = Step_from(bm->values[ix]);
   }
 
-  putu64(step.moves);
-  putchar(':');
-  putchar('\n');
-  State_print(&bm->keys[ix]);
-  putchar('\n');
+  return len;
 }
 
-static void solve(State input) {
+// Only canonical keys are stored, so the path is replayed from the start to
+// print the actual states
+static void print_steps(const State *start, const u64 *keys, usize len) {
+  State current = *start;
+  State next[NEXT_MAX];
+
+  for (usize step = 1; step < len; step++) {
+    usize next_len = State_next(&current, next);
+
+    usize i = 0;
+    while (i < next_len && State_key(&next[i]) != keys[step]) {
+      i++;
+    }
+    if (i == next_len) {
+      panic("Broken path\n");
+    }
+    current = next[i];
+
+    putu64(step);
+    putchar(':');
+    putchar('\n');
+    State_print(&current);
+    putchar('\n');
+  }
+}
+
+static SearchResult solve_pq(State input, SearchMode mode, bool print) {
   PQ *q = (PQ *)calloc(1, sizeof(PQ));
   BestMoves *bm = (BestMoves *)calloc(1, sizeof(BestMoves));
+  SearchResult result = {
+      .moves = UINT64_MAX,
+  };
 
+  usize pairs = State_pairs(&input);
   MoveState m_input = {
       .moves = 0,
-      .state = input,
+      .f = 0,
+      .key = State_key(&input),
   };
   PQ_insert(q, m_input);
-  Step origin = {
-      .moves = 0,
-  };
-  BestMoves_insert(bm, input, origin);
+  BestMoves_insert(bm, State_key(&input), Step_mk(0, 0));
+
+  State next[NEXT_MAX];
 
   while (q->len > 0) {
     PQExtract current = PQ_extract(q);
     assert(current.valid);
 
-    usize ix = BestMoves_entry_ix(bm, &current.dat.state);
+    u64 key = current.dat.key;
+    usize ix = BestMoves_entry_ix(bm, &key);
     assert(bm->occupied[ix]);
-    usize moves = bm->values[ix].moves;
+    usize moves = Step_moves(bm->values[ix]);
 
-    if (State_is_goal(&current.dat.state)) {
-      print_steps(bm, ix);
+    // Superseded by a shorter path
+    if (current.dat.moves > moves) {
+      continue;
+    }
 
-      return;
+    State state = State_from_key(key, pairs);
+    if (State_is_goal(&state)) {
+      result.moves = moves;
+      if (print) {
+        u64 *keys = (u64 *)calloc(moves + 1, sizeof(u64));
+        print_steps(&input, keys, path_keys(bm, ix, keys));
+        free(keys);
+      }
+      break;
     }
 
-    FloorState current_floor =
-        current.dat.state.floors[current.dat.state.elevator];
-    for (usize i = 0; i < FloorState_size; i++) {
-      if (!FloorState_contains(current_floor, i)) {
+    result.expanded++;
+
+    usize next_len = State_next(&state, next);
+    for (usize i = 0; i < next_len; i++) {
+      u64 next_key = State_key(&next[i]);
+      Step *next_step = BestMoves_insert_modify(bm, next_key, STEP_UNREACHED);
+
+      if (moves + 1 < Step_moves(*next_step)) {
+        *next_step = Step_mk(moves + 1, ix);
+        MoveState m_next = {
+            .moves = moves + 1,
+            .f = mode == SEARCH_ASTAR
+                     ? moves + 1 + State_lower_bound(&next[i])
+                     : State_greedy_rank(&next[i]),
+            .key = next_key,
+        };
+        PQ_insert(q, m_next);
+      }
+    }
+  }
+
+  free(q);
+  free(bm);
+  return result;
+}
+
+typedef struct {
+  u64 *dat; // keys
+  usize len;
+} Frontier;
+
+// Expand a whole BFS level of one side, returns the shortest total length
+// through a state the other side has already seen (UINT64_MAX if none)
+static usize bidir_expand(BestMoves *self, const BestMoves *other,
+                          const Frontier *current, Frontier *next_level,
+                          usize pairs, u64 *meet) {
+  usize best = UINT64_MAX;
+  State next[NEXT_MAX];
+  next_level->len = 0;
+
+  for (usize c = 0; c < current->len; c++) {
+    u64 key = current->dat[c];
+    usize ix = BestMoves_entry_ix(self, &key);
+    usize moves = Step_moves(self->values[ix]);
+
+    State state = State_from_key(key, pairs);
+    usize next_len = State_next(&state, next);
+    for (usize i = 0; i < next_len; i++) {
+      u64 next_key = State_key(&next[i]);
+      if (BestMoves_contains(self, &next_key)) {
         continue;
       }
 
-      for (usize j = 0; j < FloorState_size; j++) {
-        if (!FloorState_contains(current_floor, j)) {
+      BestMoves_insert(self, next_key, Step_mk(moves + 1, ix));
+      next_level->dat[next_level->len++] = next_key;
+
+      usize other_ix = BestMoves_entry_ix(other, &next_key);
+      if (other->occupied[other_ix] &&
+          moves + 1 + Step_moves(other->values[other_ix]) < best) {
+        best = moves + 1 + Step_moves(other->values[other_ix]);
+        *meet = next_key;
+      }
+    }
+  }
+
+  return best;
+}
+
+// Moves can always be undone, so the goal side searches with the same moves
+static SearchResult solve_bidir(State input, bool print) {
+  BestMoves *fwd = (BestMoves *)calloc(1, sizeof(BestMoves));
+  BestMoves *bwd = (BestMoves *)calloc(1, sizeof(BestMoves));
+  Frontier levels[2][2];
+  for (usize i = 0; i < 4; i++) {
+    levels[i / 2][i % 2].dat = (u64 *)calloc(STATE_COUNT, sizeof(u64));
+    levels[i / 2][i % 2].len = 0;
+  }
+
+  usize pairs = State_pairs(&input);
+  State goal = State_goal(&input);
+
+  BestMoves_insert(fwd, State_key(&input), Step_mk(0, 0));
+  BestMoves_insert(bwd, State_key(&goal), Step_mk(0, 0));
+  levels[0][0].dat[levels[0][0].len++] = State_key(&input);
+  levels[1][0].dat[levels[1][0].len++] = State_key(&goal);
+
+  SearchResult result = {
+      .moves = State_key(&input) == State_key(&goal) ? 0 : UINT64_MAX,
+  };
+  u64 meet = State_key(&input);
+  usize cur[2] = {0, 0};
+
+  while (result.moves == UINT64_MAX) {
+    // Grow the side with the smaller frontier
+    usize side = levels[0][cur[0]].len <= levels[1][cur[1]].len ? 0 : 1;
+    BestMoves *self = side == 0 ? fwd : bwd;
+    BestMoves *other = side == 0 ? bwd : fwd;
+    Frontier *current = &levels[side][cur[side]];
+
+    if (current->len == 0) {
+      break; // No solution
+    }
+
+    result.expanded += current->len;
+    result.moves = bidir_expand(self, other, current,
+                                &levels[side][1 - cur[side]], pairs, &meet);
+    cur[side] = 1 - cur[side];
+  }
+
+  if (print && result.moves != UINT64_MAX) {
+    u64 *keys = (u64 *)calloc(result.moves + 1, sizeof(u64));
+    usize len = path_keys(fwd, BestMoves_entry_ix(fwd, &meet), keys);
+
+    usize ix = BestMoves_entry_ix(bwd, &meet);
+    while (Step_moves(bwd->values[ix]) > 0) {
+      ix = Step_from(bwd->values[ix]);
+      keys[len++] = bwd->keys[ix];
+    }
+
+    print_steps(&input, keys, len);
+    free(keys);
+  }
+
+  for (usize i = 0; i < 4; i++) {
+    free(levels[i / 2][i % 2].dat);
+  }
+  free(fwd);
+  free(bwd);
+  return result;
+}
+
+// BFS where every canonical state is its rank: visited is one bit per state
+// and parents (only when printing the path) a u32 per state, indexed by rank
+static SearchResult solve_ranked(State input, bool print) {
+  usize pairs = State_pairs(&input);
+  u64 count = rank_count(pairs);
+  assert(count < UINT32_MAX);
+
+  u64 *visited = (u64 *)calloc(count / 64 + 1, sizeof(u64));
+  u32 *parent = print ? (u32 *)calloc(count, sizeof(u32)) : NULL;
+  u32 *levels[2] = {
+      (u32 *)calloc(count, sizeof(u32)),
+      (u32 *)calloc(count, sizeof(u32)),
+  };
+
+  State goal_state = State_goal(&input);
+  u32 goal = (u32)State_key(&goal_state);
+  u32 start = (u32)State_key(&input);
+  visited[start / 64] |= 1ul << (start % 64);
+  if (print) {
+    parent[start] = start;
+  }
+  levels[0][0] = start;
+
+  SearchResult result = {
+      .moves = start == goal ? 0 : UINT64_MAX,
+  };
+  usize len = 1;
+  State next[NEXT_MAX];
+
+  for (usize depth = 0; len > 0 && result.moves == UINT64_MAX; depth++) {
+    u32 *current = levels[depth & 1];
+    u32 *next_level = levels[(depth + 1) & 1];
+    usize next_len = 0;
+
+    for (usize c = 0; c < len; c++) {
+      State state = State_from_key(current[c], pairs);
+      result.expanded++;
+
+      usize n = State_next(&state, next);
+      for (usize i = 0; i < n; i++) {
+        u32 r = (u32)State_key(&next[i]);
+        u64 bit = 1ul << (r % 64);
+        if (visited[r / 64] & bit) {
+          continue;
+        }
+
+        visited[r / 64] |= bit;
+        if (print) {
+          parent[r] = current[c];
+        }
+        next_level[next_len++] = r;
+
+        if (r == goal) {
+          result.moves = depth + 1;
+        }
+      }
+    }
+
+    len = next_len;
+  }
+
+  if (print && result.moves != UINT64_MAX) {
+    u64 *keys = (u64 *)calloc(result.moves + 1, sizeof(u64));
+    u32 r = goal;
+    for (usize i = result.moves + 1; i-- > 0;) {
+      keys[i] = r;
+      r = parent[r];
+    }
+
+    print_steps(&input, keys, result.moves + 1);
+    free(keys);
+  }
+
+  free(visited);
+  free(parent);
+  free(levels[0]);
+  free(levels[1]);
+  return result;
+}
+
+// Whether the parallel and external searches print their statistics
+static bool report_stats = false;
+
+// Threads of the parallel search (--threads, all the CPUs by default)
+#define WORKERS_MAX 64
+static usize workers_len = 1;
+
+// Ranks are handed out to owners by blocks of 512 (a cache line of visited)
+#define OWNER_BLOCK 512
+
+typedef struct {
+  u64 *dat; // parent << 32 | rank
+  usize len;
+} Candidates;
+
+typedef struct ParallelBfs ParallelBfs;
+
+typedef struct {
+  ParallelBfs *bfs;
+  usize ix;
+  u64 *seen;                   // Ranks in out, this level
+  Candidates out[WORKERS_MAX]; // Expanded states, by owner
+  u32 *levels[2];              // Owned states of the current and next level
+  usize levels_len[2];
+  usize expanded;
+  u64 busy_ns;
+} Worker;
+
+struct ParallelBfs {
+  usize pairs;
+  usize depth; // Once done, of the goal if found
+  Barrier barrier;
+  usize capacity; // Of every out and level, the most ranks one owner can have
+  u64 *visited;
+  u32 *parent;
+  u32 goal;
+  bool found;
+  Worker workers[WORKERS_MAX];
+};
+
+static inline usize owner_of(u32 r) { return r / OWNER_BLOCK % workers_len; }
+
+// Phase 1: expand a slice of the level (the workers' levels one after the
+// other) into out. Visited isn't written during this phase, so it is read
+// without atomics, and seen drops the repeats from this worker.
+static void worker_expand(Worker *w, usize depth) {
+  ParallelBfs *bfs = w->bfs;
+  u64 start = now_ns();
+  usize cur = depth & 1;
+
+  for (usize o = 0; o < workers_len; o++) {
+    Candidates *c = &w->out[o];
+    for (usize i = 0; i < c->len; i++) {
+      u32 r = (u32)c->dat[i];
+      w->seen[r / 64] &= ~(1ul << (r % 64));
+    }
+    c->len = 0;
+  }
+
+  usize total = 0;
+  for (usize i = 0; i < workers_len; i++) {
+    total += bfs->workers[i].levels_len[cur];
+  }
+  usize lo = total * w->ix / workers_len;
+  usize hi = total * (w->ix + 1) / workers_len;
+
+  State next[NEXT_MAX];
+  usize base = 0;
+  for (usize i = 0; i < workers_len && base < hi; i++) {
+    const u32 *level = bfs->workers[i].levels[cur];
+    usize len = bfs->workers[i].levels_len[cur];
+    usize from = lo > base ? lo - base : 0;
+    usize to = hi - base < len ? hi - base : len;
+
+    for (usize c = from; c < to; c++) {
+      State state = State_from_key(level[c], bfs->pairs);
+      w->expanded++;
+
+      usize n = State_next(&state, next);
+      for (usize j = 0; j < n; j++) {
+        u32 r = (u32)State_key(&next[j]);
+        u64 bit = 1ul << (r % 64);
+        if ((bfs->visited[r / 64] | w->seen[r / 64]) & bit) {
           continue;
         }
-        for (usize k = 0; k < 2; k++) {
-          MoveItems items = {0};
-          MoveItems_push(&items, (Item)i);
-          if (i != j) {
-            MoveItems_push(&items, (Item)j);
-          }
-
-          Move move = {
-              .items = items,
-              .up = k == 1,
-          };
-
-          State next;
-          if (try_move(&current.dat.state, &next, move)) {
-            Step step = {
-                .moves = 0,
-            };
-            Step *next_step = BestMoves_insert_modify(bm, next, step);
-
-            if (next_step->moves == 0 || moves + 1 < next_step->moves) {
-              next_step->moves = moves + 1;
-              next_step->from_ix = ix;
-              next_step->move = move;
-              MoveState m_next = {
-                  .moves = moves + 1,
-                  .state = next,
-              };
-              PQ_insert(q, m_next);
-            }
-          }
+
+        w->seen[r / 64] |= bit;
+        Candidates *out = &w->out[owner_of(r)];
+        assert(out->len < bfs->capacity);
+        out->dat[out->len++] = (u64)level[c] << 32 | r;
+      }
+    }
+
+    base += len;
+  }
+
+  w->busy_ns += now_ns() - start;
+}
+
+// Phase 2: merge the states this worker owns from every out into visited,
+// the new ones make up its part of the next level
+static void worker_merge(Worker *w, usize depth) {
+  ParallelBfs *bfs = w->bfs;
+  u64 start = now_ns();
+  usize nxt = (depth + 1) & 1;
+  u32 *level = w->levels[nxt];
+  usize len = 0;
+
+  for (usize p = 0; p < workers_len; p++) {
+    const Candidates *c = &bfs->workers[p].out[w->ix];
+    for (usize i = 0; i < c->len; i++) {
+      u32 r = (u32)c->dat[i];
+      u64 bit = 1ul << (r % 64);
+      if (bfs->visited[r / 64] & bit) {
+        continue;
+      }
+
+      bfs->visited[r / 64] |= bit;
+      if (bfs->parent) {
+        bfs->parent[r] = (u32)(c->dat[i] >> 32);
+      }
+      level[len++] = r;
+
+      if (r == bfs->goal) {
+        __atomic_store_n(&bfs->found, true, __ATOMIC_RELAXED);
+      }
+    }
+  }
+
+  w->levels_len[nxt] = len;
+  w->busy_ns += now_ns() - start;
+}
+
+// Every worker sees the same levels and found after a barrier, so they all
+// stop at the same depth without any more synchronization
+static bool ParallelBfs_done(const ParallelBfs *bfs, usize depth) {
+  if (__atomic_load_n(&bfs->found, __ATOMIC_RELAXED)) {
+    return true;
+  }
+
+  for (usize i = 0; i < workers_len; i++) {
+    if (bfs->workers[i].levels_len[depth & 1] > 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The whole search on one worker: both phases of every level, each one
+// followed by a barrier. The workers are started once per search.
+static void worker_run(void *arg) {
+  Worker *w = (Worker *)arg;
+  ParallelBfs *bfs = w->bfs;
+
+  usize depth = 0;
+  for (; !ParallelBfs_done(bfs, depth); depth++) {
+    worker_expand(w, depth);
+    Barrier_wait(&bfs->barrier);
+    worker_merge(w, depth);
+    Barrier_wait(&bfs->barrier);
+  }
+
+  if (w->ix == 0) {
+    bfs->depth = depth;
+  }
+}
+
+static void print_workers(const ParallelBfs *bfs, u64 elapsed) {
+  for (usize i = 0; i < workers_len; i++) {
+    const Worker *w = &bfs->workers[i];
+    String out = {0};
+    String_push_str(&out, "Thread ");
+    String_push_u64(&out, i, 10);
+    String_push_str(&out, ": ");
+    String_push_u64(&out, w->expanded, 10);
+    String_push_str(&out, " states, ");
+    String_push_u64(&out, w->expanded * 1000000000ul / (w->busy_ns + 1), 10);
+    String_push_str(&out, " states/s");
+    String_println(&out);
+  }
+
+  usize expanded = 0;
+  for (usize i = 0; i < workers_len; i++) {
+    expanded += bfs->workers[i].expanded;
+  }
+  String out = {0};
+  String_push_u64(&out, workers_len, 10);
+  String_push_str(&out, " threads: ");
+  String_push_u64(&out, expanded * 1000000000ul / (elapsed + 1), 10);
+  String_push_str(&out, " states/s");
+  String_println(&out);
+}
+
+// The ranked BFS, one level at a time on workers_len threads: the visited
+// bitmap is split between the workers by blocks of ranks, so each bit only
+// ever has one writer and no atomics are needed. The levels are the same as
+// the serial search, the parents recorded (so the path printed) may differ.
+static SearchResult solve_parallel(State input, bool print) {
+  ParallelBfs *bfs = (ParallelBfs *)calloc(1, sizeof(ParallelBfs));
+  bfs->pairs = State_pairs(&input);
+  u64 count = rank_count(bfs->pairs);
+  assert(count < UINT32_MAX);
+  bfs->capacity = (count / OWNER_BLOCK / workers_len + 1) * OWNER_BLOCK;
+
+  bfs->visited = (u64 *)calloc(count / 64 + 1, sizeof(u64));
+  bfs->parent = print ? (u32 *)calloc(count, sizeof(u32)) : NULL;
+
+  Thread threads[WORKERS_MAX];
+  for (usize i = 0; i < workers_len; i++) {
+    Worker *w = &bfs->workers[i];
+    w->bfs = bfs;
+    w->ix = i;
+    w->seen = (u64 *)calloc(count / 64 + 1, sizeof(u64));
+    for (usize o = 0; o < workers_len; o++) {
+      w->out[o].dat = (u64 *)calloc(bfs->capacity, sizeof(u64));
+    }
+    w->levels[0] = (u32 *)calloc(bfs->capacity, sizeof(u32));
+    w->levels[1] = (u32 *)calloc(bfs->capacity, sizeof(u32));
+
+    if (i > 0) {
+      threads[i] = Thread_mk();
+    }
+  }
+
+  State goal_state = State_goal(&input);
+  bfs->goal = (u32)State_key(&goal_state);
+  u32 start = (u32)State_key(&input);
+  bfs->visited[start / 64] |= 1ul << (start % 64);
+  if (print) {
+    bfs->parent[start] = start;
+  }
+  bfs->workers[0].levels[0][0] = start;
+  bfs->workers[0].levels_len[0] = 1;
+  bfs->found = start == bfs->goal;
+  bfs->barrier = Barrier_mk((u32)workers_len);
+
+  u64 start_ns = now_ns();
+
+  // Worker 0 runs on the calling thread
+  for (usize i = 1; i < workers_len; i++) {
+    Thread_spawn(&threads[i], worker_run, &bfs->workers[i]);
+  }
+  worker_run(&bfs->workers[0]);
+  for (usize i = 1; i < workers_len; i++) {
+    Thread_join(&threads[i]);
+  }
+
+  SearchResult result = {
+      .moves = __atomic_load_n(&bfs->found, __ATOMIC_RELAXED) ? bfs->depth
+                                                              : UINT64_MAX,
+  };
+
+  for (usize i = 0; i < workers_len; i++) {
+    result.expanded += bfs->workers[i].expanded;
+  }
+  if (report_stats) {
+    print_workers(bfs, now_ns() - start_ns);
+  }
+
+  if (print && result.moves != UINT64_MAX) {
+    u64 *keys = (u64 *)calloc(result.moves + 1, sizeof(u64));
+    u32 r = bfs->goal;
+    for (usize i = result.moves + 1; i-- > 0;) {
+      keys[i] = r;
+      r = bfs->parent[r];
+    }
+
+    print_steps(&input, keys, result.moves + 1);
+    free(keys);
+  }
+
+  for (usize i = 0; i < workers_len; i++) {
+    Worker *w = &bfs->workers[i];
+    free(w->seen);
+    for (usize o = 0; o < workers_len; o++) {
+      free(w->out[o].dat);
+    }
+    free(w->levels[0]);
+    free(w->levels[1]);
+    if (i > 0) {
+      free(threads[i].stack);
+    }
+  }
+  free(bfs->visited);
+  free(bfs->parent);
+  free(bfs);
+  return result;
+}
+
+// Memory budget (--memory, in MiB) and directory (--dir) of the external
+// search
+static usize memory_mib = 64;
+static const char *disk_dir = "/tmp";
+
+// A sorted level or run on disk, read or written sequentially through buf.
+// Readers hold the next key in head until done.
+typedef struct {
+  i32 fd;
+  u64 *buf;
+  usize cap; // Keys
+  usize pos;
+  usize len;
+  u64 head;
+  bool done;
+} KeyFile;
+
+// Every stream gets at least that many keys of buffer
+#define IO_KEYS_MIN 8192
+#define RUNS_MAX 1024
+
+typedef struct {
+  u64 key;
+  usize run;
+} RunHead;
+
+static int RunHead_cmp(const RunHead *a, const RunHead *b) {
+  return -usize_cmp(&a->key, &b->key); // Smallest first
+}
+
+define_binary_heap(RunHeap, RunHead, RUNS_MAX, RunHead_cmp);
+
+typedef struct {
+  Arena arena; // The whole memory budget
+  RunHeap *heap;
+  usize runs; // Run files created so far, for their names
+  u64 read;   // Bytes
+  u64 written;
+} Disk;
+
+// The pid keeps concurrent searches sharing a directory apart
+static String disk_path(const char *kind, usize n) {
+  String path = {0};
+  String_push_str(&path, disk_dir);
+  String_push_str(&path, "/day11-");
+  String_push_u64(&path, (u64)sys_getpid(), 10);
+  String_push(&path, '-');
+  String_push_str(&path, kind);
+  String_push(&path, '-');
+  String_push_u64(&path, n, 10);
+  String_push(&path, 0);
+  return path;
+}
+
+static KeyFile KeyFile_create(String path, u64 *buf, usize cap) {
+  KeyFile f = {
+      .fd = sys_open((const char *)path.dat, O_WRONLY | O_CREAT | O_TRUNC,
+                     0600),
+      .buf = buf,
+      .cap = cap,
+  };
+  if (f.fd < 0) {
+    panic("Can't create file\n");
+  }
+  return f;
+}
+
+static void KeyFile_flush(Disk *disk, KeyFile *f) {
+  const u8 *dat = (const u8 *)f->buf;
+  usize bytes = f->len * sizeof(u64);
+  disk->written += bytes;
+
+  while (bytes > 0) {
+    isize n = sys_write(f->fd, dat, bytes);
+    if (n <= 0) {
+      panic("Write failed\n");
+    }
+    dat += n;
+    bytes -= (usize)n;
+  }
+
+  f->len = 0;
+}
+
+static inline void KeyFile_push(Disk *disk, KeyFile *f, u64 key) {
+  if (f->len == f->cap) {
+    KeyFile_flush(disk, f);
+  }
+  f->buf[f->len++] = key;
+}
+
+static void KeyFile_advance(Disk *disk, KeyFile *f) {
+  if (f->pos == f->len) {
+    u8 *dat = (u8 *)f->buf;
+    usize bytes = 0;
+    while (bytes < f->cap * sizeof(u64)) {
+      isize n = sys_read(f->fd, dat + bytes, f->cap * sizeof(u64) - bytes);
+      if (n < 0) {
+        panic("Read failed\n");
+      }
+      if (n == 0) {
+        break;
+      }
+      bytes += (usize)n;
+    }
+
+    assert(bytes % sizeof(u64) == 0);
+    disk->read += bytes;
+    f->pos = 0;
+    f->len = bytes / sizeof(u64);
+    if (f->len == 0) {
+      f->done = true;
+      return;
+    }
+  }
+
+  f->head = f->buf[f->pos++];
+}
+
+static KeyFile KeyFile_open(Disk *disk, String path, u64 *buf, usize cap) {
+  KeyFile f = {
+      .fd = sys_open((const char *)path.dat, O_RDONLY, 0),
+      .buf = buf,
+      .cap = cap,
+  };
+  if (f.fd < 0) {
+    panic("Can't open file\n");
+  }
+  KeyFile_advance(disk, &f);
+  return f;
+}
+
+// Expands a level into sorted runs of unique keys, as big as the budget
+// allows. Returns the states expanded.
+static usize disk_expand(Disk *disk, usize level, usize pairs) {
+  usize mark = Arena_mark(&disk->arena);
+  u64 *in_buf = ARENA_PUSH(&disk->arena, u64, IO_KEYS_MIN);
+  // Half for the keys, half for the radix sort
+  usize cap = (disk->arena.cap - disk->arena.len) / (2 * sizeof(u64)) - 64;
+  assert(cap > NEXT_MAX);
+  u64 *keys = ARENA_PUSH(&disk->arena, u64, cap);
+  usize len = 0;
+  usize expanded = 0;
+
+  KeyFile in = KeyFile_open(disk, disk_path("level", level), in_buf,
+                            IO_KEYS_MIN);
+  State next[NEXT_MAX];
+
+  while (true) {
+    usize n = 0;
+    if (!in.done) {
+      State state = State_from_key(in.head, pairs);
+      n = State_next(&state, next);
+      expanded++;
+      KeyFile_advance(disk, &in);
+    }
+
+    if (len > 0 && (len + n > cap || in.done)) {
+      radix_sort_u64(keys, len, &disk->arena);
+      usize unique = 0;
+      for (usize i = 0; i < len; i++) {
+        if (unique == 0 || keys[unique - 1] != keys[i]) {
+          keys[unique++] = keys[i];
         }
       }
+
+      KeyFile run = KeyFile_create(disk_path("run", disk->runs++), keys, cap);
+      run.len = unique;
+      KeyFile_flush(disk, &run);
+      sys_close(run.fd);
+      len = 0;
+    }
+
+    for (usize i = 0; i < n; i++) {
+      keys[len++] = State_key(&next[i]);
+    }
+
+    if (in.done && len == 0) {
+      break;
+    }
+  }
+
+  sys_close(in.fd);
+  Arena_reset(&disk->arena, mark);
+  return expanded;
+}
+
+// Merges the runs [first, last) into out, without repeats nor the keys of
+// the exclude files (all sorted, so it is a single pass over each). The runs
+// are deleted. Returns the keys written, found is set when goal is one.
+static usize disk_merge(Disk *disk, usize first, usize last, String out_path,
+                        const String *exclude, usize exclude_len, u64 goal,
+                        bool *found) {
+  usize mark = Arena_mark(&disk->arena);
+  usize runs_len = last - first;
+  usize streams = runs_len + exclude_len + 1;
+  KeyFile *files = ARENA_PUSH(&disk->arena, KeyFile, streams);
+  usize cap = (disk->arena.cap - disk->arena.len) / sizeof(u64) / streams - 8;
+  assert(cap >= IO_KEYS_MIN);
+
+  KeyFile *runs = files;
+  KeyFile *excl = &files[runs_len];
+  KeyFile *out = &files[runs_len + exclude_len];
+
+  RunHeap *heap = disk->heap;
+  heap->len = 0;
+  for (usize i = 0; i < runs_len; i++) {
+    u64 *buf = ARENA_PUSH(&disk->arena, u64, cap);
+    runs[i] = KeyFile_open(disk, disk_path("run", first + i), buf, cap);
+    if (!runs[i].done) {
+      RunHeap_insert(heap, (RunHead){runs[i].head, i});
+    }
+  }
+  for (usize i = 0; i < exclude_len; i++) {
+    u64 *buf = ARENA_PUSH(&disk->arena, u64, cap);
+    excl[i] = KeyFile_open(disk, exclude[i], buf, cap);
+  }
+  *out = KeyFile_create(out_path, ARENA_PUSH(&disk->arena, u64, cap), cap);
+
+  usize written = 0;
+  u64 last_key = 0;
+  while (heap->len > 0) {
+    RunHead min = UNWRAP(RunHeap_extract(heap));
+    KeyFile *run = &runs[min.run];
+    KeyFile_advance(disk, run);
+    if (!run->done) {
+      RunHeap_insert(heap, (RunHead){run->head, min.run});
+    }
+
+    if (written > 0 && min.key == last_key) {
+      continue;
+    }
+    last_key = min.key;
+
+    bool seen = false;
+    for (usize i = 0; i < exclude_len; i++) {
+      while (!excl[i].done && excl[i].head < min.key) {
+        KeyFile_advance(disk, &excl[i]);
+      }
+      seen |= !excl[i].done && excl[i].head == min.key;
+    }
+    if (seen) {
+      continue;
+    }
+
+    KeyFile_push(disk, out, min.key);
+    written++;
+    *found |= min.key == goal;
+  }
+
+  KeyFile_flush(disk, out);
+  for (usize i = 0; i < streams; i++) {
+    sys_close(files[i].fd);
+  }
+  for (usize i = first; i < last; i++) {
+    String path = disk_path("run", i);
+    sys_unlink((const char *)path.dat);
+  }
+
+  Arena_reset(&disk->arena, mark);
+  return written;
+}
+
+// Walks back from the goal: a neighbour of the state on the level before
+// (moves can be undone) is found by a pass over that level's file
+static void disk_path_keys(Disk *disk, usize moves, usize pairs, u64 *keys) {
+  usize mark = Arena_mark(&disk->arena);
+  u64 *buf = ARENA_PUSH(&disk->arena, u64, IO_KEYS_MIN);
+  u64 neighbours[NEXT_MAX];
+  State next[NEXT_MAX];
+
+  for (usize d = moves; d-- > 0;) {
+    State state = State_from_key(keys[d + 1], pairs);
+    usize n = State_next(&state, next);
+    for (usize i = 0; i < n; i++) {
+      neighbours[i] = State_key(&next[i]);
+    }
+    radix_sort_u64(neighbours, n, &disk->arena);
+
+    KeyFile level = KeyFile_open(disk, disk_path("level", d), buf,
+                                 IO_KEYS_MIN);
+    usize i = 0;
+    while (!level.done && i < n && level.head != neighbours[i]) {
+      if (level.head < neighbours[i]) {
+        KeyFile_advance(disk, &level);
+      } else {
+        i++;
+      }
+    }
+    if (level.done || i == n) {
+      panic("Broken path\n");
+    }
+
+    keys[d] = level.head;
+    sys_close(level.fd);
+  }
+
+  Arena_reset(&disk->arena, mark);
+}
+
+// BFS in a fixed memory budget with the levels on disk, as sorted files of
+// keys. A level is expanded into sorted runs which are then merged, dropping
+// the repeats (delayed duplicate detection). Moves can be undone, so the
+// states already seen can only come from the level expanded and the one
+// before, which are merged against.
+static SearchResult solve_external(State input, bool print) {
+  assert(memory_mib > 0);
+  Disk disk = {
+      .arena = Arena_mk(memory_mib << 20),
+      .heap = (RunHeap *)calloc(1, sizeof(RunHeap)),
+  };
+  usize fan_in = (disk.arena.cap / 2) / (IO_KEYS_MIN * sizeof(u64)) - 3;
+  fan_in = fan_in < RUNS_MAX ? fan_in : RUNS_MAX;
+  assert(fan_in >= 2);
+
+  usize pairs = State_pairs(&input);
+  State goal_state = State_goal(&input);
+  u64 goal = State_key(&goal_state);
+  u64 start = State_key(&input);
+
+  KeyFile level = KeyFile_create(disk_path("level", 0), &start, 1);
+  level.len = 1;
+  KeyFile_flush(&disk, &level);
+  sys_close(level.fd);
+
+  SearchResult result = {
+      .moves = start == goal ? 0 : UINT64_MAX,
+  };
+  usize level_len = 1;
+  usize level_max = 1;
+  usize depth = 0;
+
+  for (; result.moves == UINT64_MAX && level_len > 0; depth++) {
+    usize first = disk.runs;
+    result.expanded += disk_expand(&disk, depth, pairs);
+
+    // Too many runs for one merge, merge them in groups first
+    while (disk.runs - first > fan_in) {
+      bool unused_found = false;
+      disk_merge(&disk, first, first + fan_in, disk_path("run", disk.runs++),
+                 NULL, 0, goal, &unused_found);
+      first += fan_in;
+    }
+
+    String exclude[2] = {disk_path("level", depth)};
+    if (depth > 0) {
+      exclude[1] = disk_path("level", depth - 1);
+    }
+
+    bool found = false;
+    level_len = disk_merge(&disk, first, disk.runs,
+                           disk_path("level", depth + 1), exclude,
+                           depth > 0 ? 2 : 1, goal, &found);
+    level_max = level_len > level_max ? level_len : level_max;
+    if (found) {
+      result.moves = depth + 1;
     }
   }
+
+  if (print && result.moves != UINT64_MAX) {
+    u64 *keys = (u64 *)calloc(result.moves + 1, sizeof(u64));
+    keys[result.moves] = goal;
+    disk_path_keys(&disk, result.moves, pairs, keys);
+    print_steps(&input, keys, result.moves + 1);
+    free(keys);
+  }
+
+  for (usize d = 0; d <= depth; d++) {
+    String path = disk_path("level", d);
+    sys_unlink((const char *)path.dat);
+  }
+
+  if (report_stats) {
+    String out = {0};
+    String_push_str(&out, "Disk: ");
+    String_push_u64(&out, depth + 1, 10);
+    String_push_str(&out, " levels, ");
+    String_push_u64(&out, level_max, 10);
+    String_push_str(&out, " states in the largest, ");
+    String_push_u64(&out, disk.written >> 10, 10);
+    String_push_str(&out, " KiB written, ");
+    String_push_u64(&out, disk.read >> 10, 10);
+    String_push_str(&out, " KiB read");
+    String_println(&out);
+  }
+
+  free(disk.heap);
+  return result;
+}
+
+static SearchResult solve(State input, SearchMode mode, bool print) {
+  switch (mode) {
+  case SEARCH_BIDIR:
+    return solve_bidir(input, print);
+  case SEARCH_RANKED:
+    return solve_ranked(input, print);
+  case SEARCH_PARALLEL:
+    return solve_parallel(input, print);
+  case SEARCH_EXTERNAL:
+    return solve_external(input, print);
+  default:
+    return solve_pq(input, mode, print);
+  }
+}
+
+static void add_pairs(State *state) {
+  u8 elerium = get_id(Span_from_str("elerium"));
+  u8 dilithium = get_id(Span_from_str("dilithium"));
+  FloorState_insert(&state->floors[0], Item_mk(elerium, true));
+  FloorState_insert(&state->floors[0], Item_mk(elerium, false));
+  FloorState_insert(&state->floors[0], Item_mk(dilithium, true));
+  FloorState_insert(&state->floors[0], Item_mk(dilithium, false));
+}
+
+// Moves and expanded states of every search mode
+static void compare(State input) {
+  for (usize mode = 0; mode < SEARCH_MODES; mode++) {
+    SearchResult res = solve(input, (SearchMode)mode, false);
+
+    String out = {0};
+    String_push_str(&out, search_names[mode]);
+    String_push_str(&out, ": ");
+    if (res.moves == UINT64_MAX) {
+      String_push_str(&out, "no solution, ");
+    } else {
+      String_push_u64(&out, res.moves, 10);
+      String_push_str(&out, " moves, ");
+    }
+    String_push_u64(&out, res.expanded, 10);
+    String_push_str(&out, " expanded");
+    String_println(&out);
+  }
+}
+
+static void print_moves(SearchResult res) {
+  String out = {0};
+  String_push_str(&out, "Moves: ");
+  if (res.moves == UINT64_MAX) {
+    String_push_str(&out, "no solution");
+  } else {
+    String_push_u64(&out, res.moves, 10);
+  }
+  String_println(&out);
 }
 
+// `day11 [file] [greedy|astar|bidir|ranked|parallel|external|compare]
+//   [--no-path] [--threads <n>] [--memory <MiB>] [--dir <path>]`
 int main(void) {
   // State example = State_parse(
   //     Span_from_str("The first floor contains a hydrogen-compatible microchip
@@ -369,23 +1421,82 @@ int main(void) {
   // printf("Example:\n");
   // State_print(&example);
   // printf("\n");
-  // solve(example);
+  // solve(example, SEARCH_ASTAR, true);
+
+  binomial_init();
+
+  const char *modes[SEARCH_MODES + 1];
+  for (usize m = 0; m < SEARCH_MODES; m++) {
+    modes[m] = search_names[m];
+  }
+  modes[SEARCH_MODES] = "compare";
+
+  const CliFlag flags[] = {
+      {.name = "--no-path", .value = false},
+      {.name = "--threads", .value = true},
+      {.name = "--memory", .value = true},
+      {.name = "--dir", .value = true},
+  };
+  Cli cli = Cli_parse(modes, SEARCH_MODES + 1, flags, 4);
+  if (cli.mode_args_len > 0) {
+    panic("Unexpected argument\n");
+  }
+
+  SearchMode mode = SEARCH_ASTAR;
+  for (usize m = 0; m < SEARCH_MODES; m++) {
+    if (cli.mode != NULL && streq(cli.mode, search_names[m])) {
+      mode = (SearchMode)m;
+    }
+  }
+  bool comparing = cli.mode != NULL && streq(cli.mode, "compare");
+
+  workers_len = cpu_count();
+  report_stats = mode == SEARCH_PARALLEL || mode == SEARCH_EXTERNAL;
+
+  bool print = !Cli_flag(&cli, "--no-path");
+  const char *threads = Cli_value(&cli, "--threads");
+  if (threads != NULL) {
+    workers_len = UNWRAP(Span_parse_u64(Span_from_str(threads), 10)).fst;
+  }
+  const char *memory = Cli_value(&cli, "--memory");
+  if (memory != NULL) {
+    memory_mib = UNWRAP(Span_parse_u64(Span_from_str(memory), 10)).fst;
+  }
+  const char *dir = Cli_value(&cli, "--dir");
+  if (dir != NULL) {
+    disk_dir = dir;
+  }
+
+  assert(workers_len > 0);
+  workers_len = workers_len < WORKERS_MAX ? workers_len : WORKERS_MAX;
+
+  const char *path = cli.path != NULL ? cli.path : "inputs/day11.txt";
+  State input = State_parse(Span_from_file(path));
+
+  if (comparing) {
+    compare(input);
+    add_pairs(&input);
+    compare(input);
+    return 0;
+  }
 
-  State input = State_parse(Span_from_file("inputs/day11.txt"));
   putstr("Input:\n");
   State_print(&input);
   putstr("\n");
-  solve(input);
+  SearchResult res = solve(input, mode, print);
+  if (!print) {
+    print_moves(res);
+  }
 
-  FloorState_insert(&input.floors[0], Item_mk(get_id('e'), true));
-  FloorState_insert(&input.floors[0], Item_mk(get_id('e'), false));
-  FloorState_insert(&input.floors[0], Item_mk(get_id('d'), true));
-  FloorState_insert(&input.floors[0], Item_mk(get_id('d'), false));
+  add_pairs(&input);
 
   putstr("\n\nModified:\n");
   State_print(&input);
   putstr("\n");
-  solve(input);
+  res = solve(input, mode, print);
+  if (!print) {
+    print_moves(res);
+  }
 
   return 0;
 }
@@ -92,6 +92,7 @@ void Instr_print(Instr i) {
       String_push_str(&out, ", .y = ");
       String_push(&out, i.y.dat.r + 'a');
     }
+    String_push_str(&out, " }");
   } break;
   case Inc: {
     String_push_str(&out, "Inc { .x = ");
@@ -115,16 +116,20 @@ void Instr_print(Instr i) {
       String_push_str(&out, ", .y = ");
       String_push_i64(&out, i.y.dat.i, 10);
     }
+    String_push_str(&out, " }");
     break;
   }
   String_println(&out);
 }
 
-define_array(Program, Instr, 32);
+#define PROGRAM_MAX 32
+
+define_array(Program, Instr, PROGRAM_MAX);
 
 typedef struct {
   i32 pc;
   i32 regs[4];
+  u64 steps; // Instructions executed
 } VM;
 
 static void VM_print(const VM *vm) {
@@ -143,9 +148,23 @@ static void VM_print(const VM *vm) {
   String_print(&out);
 }
 
-static void VM_eval(VM *vm, const Program *program) {
+// What ran, per pc
+typedef struct {
+  u64 hits[PROGRAM_MAX];
+  u64 taken[PROGRAM_MAX]; // jnz only
+  u64 cycles;             // rdtsc
+} Profile;
+
+// The reference interpreter, counting into profile unless it is NULL
+static void VM_eval(VM *vm, const Program *program, Profile *profile) {
+  u64 start = profile ? __builtin_ia32_rdtsc() : 0;
+
   while (vm->pc >= 0 && vm->pc < (i32)program->len) {
     Instr instr = program->dat[vm->pc];
+    vm->steps++;
+    if (profile) {
+      profile->hits[vm->pc]++;
+    }
 
     switch (instr.tag) {
     case Cpy:
@@ -164,6 +183,9 @@ static void VM_eval(VM *vm, const Program *program) {
     case Jnz: {
       int cond = instr.x.tag == Reg ? vm->regs[instr.x.dat.r] : instr.x.dat.i;
       if (cond != 0) {
+        if (profile) {
+          profile->taken[vm->pc]++;
+        }
         vm->pc += instr.y.dat.i - 1;
       }
     } break;
@@ -171,9 +193,785 @@ static void VM_eval(VM *vm, const Program *program) {
 
     vm->pc++;
   }
+
+  if (profile) {
+    profile->cycles += __builtin_ia32_rdtsc() - start;
+  }
+}
+
+// Instructions specialised on the kind of their operands, jnz with a constant
+// becomes a plain jump or nothing
+typedef enum {
+  OP_CPY_REG,
+  OP_CPY_IMM,
+  OP_INC,
+  OP_DEC,
+  OP_JNZ,
+  OP_JMP,
+  OP_NOP,
+  OP_HALT,
+  // Superinstructions for whole loops, see Code_fuse_loops
+  OP_CLR,
+  OP_ADD,
+  OP_MUL,
+} Opcode;
+
+typedef struct {
+  u8 op;
+  u8 x; // Registers
+  u8 y;
+  i32 imm; // Constant, absolute target of jumps, pc to stop at for OP_HALT
+
+  // Superinstructions keep the fields of the instruction they stand in for,
+  // and run it instead when the loop wouldn't end (fallback)
+  u8 fallback;
+  u8 len;     // Instructions of the loop
+  u8 counter; // Stepped by step until 0
+  u8 dst;     // Gets delta per iteration (of both loops for mul)
+  u8 outer;   // Counter of the outer loop of mul, stepped by outer_step
+  i8 step;
+  i8 delta;
+  i8 outer_step;
+} Op;
+
+// The compiled program is followed by an OP_HALT for falling off the end,
+// and one for each jump leaving the program
+define_array(Code, Op, 2 * PROGRAM_MAX + 1);
+
+static u32 Code_target(Code *code, const Program *program, i32 pc, i32 offset) {
+  i32 target = pc + offset;
+  if (target >= 0 && target < (i32)program->len) {
+    return (u32)target;
+  }
+
+  Op halt = {.op = OP_HALT, .imm = target};
+  Code_push(code, halt);
+  return (u32)(code->len - 1);
+}
+
+static Code Program_compile(const Program *program) {
+  Code code = {0};
+  code.len = program->len;
+
+  Op end = {.op = OP_HALT, .imm = (i32)program->len};
+  Code_push(&code, end);
+
+  for (usize pc = 0; pc < program->len; pc++) {
+    Instr instr = program->dat[pc];
+    Op op = {0};
+
+    switch (instr.tag) {
+    case Cpy:
+      if (instr.x.tag == Reg) {
+        op.op = OP_CPY_REG;
+        op.x = instr.x.dat.r;
+      } else {
+        op.op = OP_CPY_IMM;
+        op.imm = instr.x.dat.i;
+      }
+      op.y = instr.y.dat.r;
+      break;
+    case Inc:
+      op.op = OP_INC;
+      op.x = instr.x.dat.r;
+      break;
+    case Dec:
+      op.op = OP_DEC;
+      op.x = instr.x.dat.r;
+      break;
+    case Jnz:
+      if (instr.x.tag == Reg) {
+        op.op = OP_JNZ;
+        op.x = instr.x.dat.r;
+      } else {
+        op.op = instr.x.dat.i != 0 ? OP_JMP : OP_NOP;
+      }
+      if (op.op != OP_NOP) {
+        op.imm = (i32)Code_target(&code, program, (i32)pc, instr.y.dat.i);
+      }
+      break;
+    }
+
+    code.dat[pc] = op;
+  }
+
+  return code;
+}
+
+static inline i8 Op_step(Op op) {
+  return op.op == OP_INC ? 1 : op.op == OP_DEC ? -1 : 0;
+}
+
+// `inc/dec r; jnz r -1` at pc
+static bool match_clr(const Code *code, usize len, usize pc, Op *loop) {
+  if (pc + 2 > len) {
+    return false;
+  }
+
+  Op step = code->dat[pc];
+  Op jnz = code->dat[pc + 1];
+  if (Op_step(step) == 0 || jnz.op != OP_JNZ || jnz.x != step.x ||
+      jnz.imm != (i32)pc) {
+    return false;
+  }
+
+  loop->op = OP_CLR;
+  loop->len = 2;
+  loop->counter = step.x;
+  loop->step = Op_step(step);
+  return true;
+}
+
+// `inc/dec dst; inc/dec counter; jnz counter -2`, the first two either way
+static bool match_add(const Code *code, usize len, usize pc, Op *loop) {
+  if (pc + 3 > len) {
+    return false;
+  }
+
+  Op a = code->dat[pc];
+  Op b = code->dat[pc + 1];
+  Op jnz = code->dat[pc + 2];
+  if (Op_step(a) == 0 || Op_step(b) == 0 || a.x == b.x || jnz.op != OP_JNZ ||
+      jnz.imm != (i32)pc || (jnz.x != a.x && jnz.x != b.x)) {
+    return false;
+  }
+
+  Op dst = jnz.x == a.x ? b : a;
+  Op counter = jnz.x == a.x ? a : b;
+  loop->op = OP_ADD;
+  loop->len = 3;
+  loop->counter = counter.x;
+  loop->step = Op_step(counter);
+  loop->dst = dst.x;
+  loop->delta = Op_step(dst);
+  return true;
+}
+
+// `cpy src counter; <add loop on counter>; inc/dec outer; jnz outer -5`,
+// src untouched by the loops
+static bool match_mul(const Code *code, usize len, usize pc, Op *loop) {
+  if (pc + 6 > len) {
+    return false;
+  }
+
+  Op cpy = code->dat[pc];
+  Op add = {0};
+  Op outer = code->dat[pc + 4];
+  Op jnz = code->dat[pc + 5];
+  if ((cpy.op != OP_CPY_REG && cpy.op != OP_CPY_IMM) ||
+      !match_add(code, len, pc + 1, &add) || add.counter != cpy.y ||
+      Op_step(outer) == 0 || outer.x == add.counter || outer.x == add.dst ||
+      jnz.op != OP_JNZ || jnz.x != outer.x || jnz.imm != (i32)pc) {
+    return false;
+  }
+
+  if (cpy.op == OP_CPY_REG &&
+      (cpy.x == add.dst || cpy.x == add.counter || cpy.x == outer.x)) {
+    return false;
+  }
+
+  loop->op = OP_MUL;
+  loop->len = 6;
+  loop->counter = add.counter;
+  loop->step = add.step;
+  loop->dst = add.dst;
+  loop->delta = add.delta;
+  loop->outer = outer.x;
+  loop->outer_step = Op_step(outer);
+  return true;
+}
+
+// Peephole pass replacing the first instruction of clear, add and multiply
+// loops (by repeated adds, a nested loop) with a superinstruction doing all
+// the iterations at once. The rest of the loop is left as is, so jumping
+// into the middle of it still works, and the step count is the same as
+// running the loop.
+static void Code_fuse_loops(Code *code, usize len) {
+  for (usize pc = 0; pc < len; pc++) {
+    Op loop = code->dat[pc];
+    loop.fallback = loop.op;
+
+    if (match_mul(code, len, pc, &loop) || match_add(code, len, pc, &loop) ||
+        match_clr(code, len, pc, &loop)) {
+      code->dat[pc] = loop;
+    }
+  }
+}
+
+// Iterations until a counter stepped by step reaches 0, or 0 when it never
+// does without wrapping around
+static inline u64 iterations(i32 counter, i8 step) {
+  if (counter == 0 || (counter < 0) == (step < 0)) {
+    return 0;
+  }
+  return counter < 0 ? (u64) - (i64)counter : (u64)counter;
+}
+
+static inline i32 wrapping_add(i32 x, i8 delta, u64 times) {
+  u32 total = (u32)times;
+  return (i32)(delta < 0 ? (u32)x - total : (u32)x + total);
+}
+
+// Threaded code: every handler ends with its own indirect jump to the next
+// one, which predicts much better than a single switch
+static void VM_run(VM *vm, const Code *code) {
+  static void *const dispatch[] = {
+      [OP_CPY_REG] = &&cpy_reg, [OP_CPY_IMM] = &&cpy_imm, [OP_INC] = &&inc,
+      [OP_DEC] = &&dec,         [OP_JNZ] = &&jnz,         [OP_JMP] = &&jmp,
+      [OP_NOP] = &&nop,         [OP_HALT] = &&halt,       [OP_CLR] = &&clr,
+      [OP_ADD] = &&add,         [OP_MUL] = &&mul,
+  };
+
+  // Only the program itself, the halts past it can't be started at
+  if (vm->pc < 0 || vm->pc >= (i32)code->len ||
+      code->dat[vm->pc].op == OP_HALT) {
+    return;
+  }
+
+  i32 *regs = vm->regs;
+  const Op *ops = code->dat;
+  const Op *op = &ops[vm->pc];
+  u64 steps = vm->steps;
+
+#define NEXT(NEXT_OP)                                                          \
+  do {                                                                         \
+    steps++;                                                                   \
+    op = NEXT_OP;                                                              \
+    goto *dispatch[op->op];                                                    \
+  } while (0)
+
+  // Skip a whole loop
+#define SKIP(STEPS)                                                            \
+  do {                                                                         \
+    steps += STEPS;                                                            \
+    op += op->len;                                                             \
+    goto *dispatch[op->op];                                                    \
+  } while (0)
+
+  goto *dispatch[op->op];
+
+cpy_reg:
+  regs[op->y] = regs[op->x];
+  NEXT(op + 1);
+cpy_imm:
+  regs[op->y] = op->imm;
+  NEXT(op + 1);
+inc:
+  regs[op->x]++;
+  NEXT(op + 1);
+dec:
+  regs[op->x]--;
+  NEXT(op + 1);
+jnz:
+  NEXT(regs[op->x] != 0 ? &ops[op->imm] : op + 1);
+jmp:
+  NEXT(&ops[op->imm]);
+nop:
+  NEXT(op + 1);
+clr: {
+  u64 n = iterations(regs[op->counter], op->step);
+  if (n == 0) {
+    goto *dispatch[op->fallback];
+  }
+  regs[op->counter] = 0;
+  SKIP(2 * n);
+}
+add: {
+  u64 n = iterations(regs[op->counter], op->step);
+  if (n == 0) {
+    goto *dispatch[op->fallback];
+  }
+  regs[op->dst] = wrapping_add(regs[op->dst], op->delta, n);
+  regs[op->counter] = 0;
+  SKIP(3 * n);
+}
+mul: {
+  i32 src = op->fallback == OP_CPY_REG ? regs[op->x] : op->imm;
+  u64 inner = iterations(src, op->step);
+  u64 outer = iterations(regs[op->outer], op->outer_step);
+  if (inner == 0 || outer == 0) {
+    goto *dispatch[op->fallback];
+  }
+  // Every outer iteration is the cpy, the inner loop, and the outer step and
+  // jnz
+  regs[op->dst] = wrapping_add(regs[op->dst], op->delta, inner * outer);
+  regs[op->counter] = 0;
+  regs[op->outer] = 0;
+  SKIP(outer * (3 + 3 * inner));
+}
+halt:
+  vm->pc = op->imm;
+  vm->steps = steps;
+
+#undef NEXT
+#undef SKIP
+}
+
+// x86-64 code for a program: a..d live in r8d..r11d and the step count in
+// rcx, jnz is a native conditional jump. The function takes the VM in rdi.
+typedef void (*JitFn)(VM *vm);
+
+#define JIT_SIZE 4096
+
+typedef struct {
+  u8 *dat;
+  usize len;
+} Emitter;
+
+static void emit(Emitter *e, const u8 *bytes, usize len) {
+  assert(e->len + len <= JIT_SIZE);
+  memcpy(e->dat + e->len, bytes, len);
+  e->len += len;
+}
+
+#define EMIT(E, ...)                                                           \
+  emit(E, (const u8[]){__VA_ARGS__}, sizeof((const u8[]){__VA_ARGS__}))
+
+static void emit_u32(Emitter *e, u32 x) {
+  EMIT(e, (u8)x, (u8)(x >> 8), (u8)(x >> 16), (u8)(x >> 24));
+}
+
+// ModRM for two registers, r8..r11 are 0..3 once REX has their top bit
+static inline u8 modrm(u8 reg, u8 rm) { return (u8)(0xC0 | reg << 3 | rm); }
+
+#define VM_PC __builtin_offsetof(VM, pc)
+#define VM_REGS __builtin_offsetof(VM, regs)
+#define VM_STEPS __builtin_offsetof(VM, steps)
+
+// Loads (0x8B) or stores (0x89) the registers and steps from [rdi]
+static void emit_vm_regs(Emitter *e, u8 opcode) {
+  for (u8 r = 0; r < 4; r++) {
+    EMIT(e, 0x44, opcode, (u8)(0x47 | r << 3), (u8)(VM_REGS + 4 * r));
+  }
+  EMIT(e, 0x48, opcode, 0x4F, (u8)VM_STEPS);
 }
 
-static void solve(Span input) {
+// Returns NULL when the code can't be mapped, the interpreter has to do.
+// Superinstructions are compiled as the instruction they stand in for, native
+// loops are fast enough.
+static JitFn Code_jit(const Code *code) {
+  Emitter e = {
+      .dat = (u8 *)sys_mmap(NULL, JIT_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0),
+  };
+  if ((isize)e.dat < 0) {
+    return NULL;
+  }
+
+  // Native offset of every op, and the rel32s to patch with the target op
+  u32 offsets[Code_capacity];
+  u32 fixups[Code_capacity];
+  u32 fixup_ops[Code_capacity];
+  usize fixups_len = 0;
+
+  emit_vm_regs(&e, 0x8B);
+  // The program is entered at pc 0, the prologue falls through to it
+
+  // Epilogue, jumped to by the halts (which have set the pc)
+  EMIT(&e, 0xE9);
+  usize skip_epilogue = e.len;
+  emit_u32(&e, 0);
+  u32 epilogue = (u32)e.len;
+  emit_vm_regs(&e, 0x89);
+  EMIT(&e, 0xC3);
+  u32 start = (u32)e.len;
+  memcpy(e.dat + skip_epilogue, &(u32){start - epilogue}, 4);
+
+  for (usize i = 0; i < code->len; i++) {
+    Op op = code->dat[i];
+    u8 opcode = op.op >= OP_CLR ? op.fallback : op.op;
+    offsets[i] = (u32)e.len;
+
+    if (opcode != OP_HALT) {
+      EMIT(&e, 0x48, 0xFF, 0xC1); // inc rcx
+    }
+
+    switch (opcode) {
+    case OP_CPY_REG: // mov y, x
+      EMIT(&e, 0x45, 0x89, modrm(op.x, op.y));
+      break;
+    case OP_CPY_IMM: // mov y, imm32
+      EMIT(&e, 0x41, (u8)(0xB8 + op.y));
+      emit_u32(&e, (u32)op.imm);
+      break;
+    case OP_INC:
+      EMIT(&e, 0x41, 0xFF, modrm(0, op.x));
+      break;
+    case OP_DEC:
+      EMIT(&e, 0x41, 0xFF, modrm(1, op.x));
+      break;
+    case OP_JNZ: // test x, x; jnz rel32
+      EMIT(&e, 0x45, 0x85, modrm(op.x, op.x), 0x0F, 0x85);
+      fixup_ops[fixups_len] = (u32)op.imm;
+      fixups[fixups_len++] = (u32)e.len;
+      emit_u32(&e, 0);
+      break;
+    case OP_JMP:
+      EMIT(&e, 0xE9);
+      fixup_ops[fixups_len] = (u32)op.imm;
+      fixups[fixups_len++] = (u32)e.len;
+      emit_u32(&e, 0);
+      break;
+    case OP_NOP:
+      break;
+    case OP_HALT: // mov dword [rdi + pc offset], pc; jmp epilogue
+      EMIT(&e, 0xC7, 0x47, (u8)VM_PC);
+      emit_u32(&e, (u32)op.imm);
+      EMIT(&e, 0xE9);
+      emit_u32(&e, epilogue - (u32)(e.len + 4));
+      break;
+    default:
+      panic("Unexpected op\n");
+    }
+  }
+
+  // rel32 is from the end of the jump
+  for (usize i = 0; i < fixups_len; i++) {
+    u32 rel = offsets[fixup_ops[i]] - (fixups[i] + 4);
+    memcpy(e.dat + fixups[i], &rel, 4);
+  }
+
+  if (sys_mprotect(e.dat, JIT_SIZE, PROT_READ | PROT_EXEC) != 0) {
+    return NULL;
+  }
+
+  return (JitFn)(void *)e.dat;
+}
+
+// 8 VMs in lockstep, one per lane, the lanes at the same pc run together
+// (lanes elsewhere are masked off)
+typedef struct {
+  i32x8 pc;
+  i32x8 regs[4];
+  u64 steps[8];
+} VMBatch;
+
+// Lanes left running when the rest goes to scalar code
+#define BATCH_STRAGGLERS 2
+
+static inline i32 Code_pc(const Code *code, i32 target) {
+  Op op = code->dat[target];
+  return op.op == OP_HALT ? op.imm : target;
+}
+
+// Runs the lanes in on (mask as bits), all at pc, until a jnz splits them,
+// they leave the program or they get to a pc where other lanes wait (waiting,
+// one bit per pc). Threaded like VM_run, with a scalar pc shared by the lanes.
+// Returns the rounds, which are steps of every lane in mask.
+static u64 VMBatch_run_group(VMBatch *b, const Code *code, i32 pc, i32x8 on,
+                             u32 mask, u64 waiting) {
+  static void *const dispatch[] = {
+      [OP_CPY_REG] = &&cpy_reg, [OP_CPY_IMM] = &&cpy_imm, [OP_INC] = &&inc,
+      [OP_DEC] = &&dec,         [OP_JNZ] = &&jnz,         [OP_JMP] = &&jmp,
+      [OP_NOP] = &&nop,         [OP_HALT] = &&halt,       [OP_CLR] = &&fallback,
+      [OP_ADD] = &&fallback,    [OP_MUL] = &&fallback,
+  };
+
+  i32x8 regs[4] = {b->regs[0], b->regs[1], b->regs[2], b->regs[3]};
+  const Op *ops = code->dat;
+  const Op *op = &ops[pc];
+  u64 rounds = 0;
+  i32x8 next = {0}; // Of every lane, once the group stops
+
+  // The halts past the program are never waited at
+#define NEXT(NEXT_OP)                                                          \
+  do {                                                                         \
+    rounds++;                                                                  \
+    op = NEXT_OP;                                                              \
+    if (unlikely(op - ops < 64 && (waiting >> (op - ops) & 1))) {              \
+      next = i32x8_splat((i32)(op - ops));                                     \
+      goto done;                                                               \
+    }                                                                          \
+    goto *dispatch[op->op];                                                    \
+  } while (0)
+
+  goto *dispatch[op->op];
+
+  // Superinstructions are run as the instruction they stand in for
+fallback:
+  goto *dispatch[op->fallback];
+cpy_reg:
+  regs[op->y] = i32x8_select(on, regs[op->x], regs[op->y]);
+  NEXT(op + 1);
+cpy_imm:
+  regs[op->y] = i32x8_select(on, i32x8_splat(op->imm), regs[op->y]);
+  NEXT(op + 1);
+inc:
+  regs[op->x] -= on;
+  NEXT(op + 1);
+dec:
+  regs[op->x] += on;
+  NEXT(op + 1);
+jnz: {
+  i32x8 nz = regs[op->x] != 0;
+  u32 taken = u32x8_movemask((u32x8)nz) & mask;
+  if (taken == mask) {
+    NEXT(&ops[op->imm]);
+  }
+  if (taken == 0) {
+    NEXT(op + 1);
+  }
+
+  rounds++;
+  next = i32x8_select(nz, i32x8_splat(Code_pc(code, op->imm)),
+                      i32x8_splat((i32)(op - ops) + 1));
+  goto done;
+}
+jmp:
+  NEXT(&ops[op->imm]);
+nop:
+  NEXT(op + 1);
+halt:
+  next = i32x8_splat(op->imm);
+
+done:
+  for (usize r = 0; r < 4; r++) {
+    b->regs[r] = regs[r];
+  }
+  b->pc = i32x8_select(on, next, b->pc);
+  return rounds;
+
+#undef NEXT
+}
+
+// Runs the lanes until at most BATCH_STRAGGLERS are left, returns the rounds.
+// The group of lanes at the lowest pc goes first, the others wait for it to
+// catch up (at the end of a loop, usually).
+static u64 VMBatch_run(VMBatch *b, const Code *code, usize len) {
+  u64 rounds = 0;
+
+  while (true) {
+    i32x8 running = (b->pc >= 0) & (b->pc < (i32)len);
+    u32 mask = u32x8_movemask((u32x8)running);
+    if ((u32)__builtin_popcount(mask) <= BATCH_STRAGGLERS) {
+      break;
+    }
+
+    i32 pc = i32x8_hmin(i32x8_select(running, b->pc, i32x8_splat(INT32_MAX)));
+    i32x8 on = running & (b->pc == pc);
+    u32 on_mask = u32x8_movemask((u32x8)on);
+
+    u64 waiting = 0;
+    for (usize i = 0; i < 8; i++) {
+      if ((mask & ~on_mask) >> i & 1) {
+        waiting |= 1ul << b->pc[i];
+      }
+    }
+
+    u64 group = VMBatch_run_group(b, code, pc, on, on_mask, waiting);
+    for (usize i = 0; i < 8; i++) {
+      b->steps[i] += (on_mask >> i & 1) * group;
+    }
+    rounds += group;
+  }
+
+  return rounds;
+}
+
+// Events per second, without overflowing n * 10^9
+static u64 per_second(u64 n, u64 ns) {
+  u128 rem;
+  return (u64)u128_divmod((u128)n * 1000000000u, (u128)ns + 1, &rem);
+}
+
+// Runs count VMs, VM k starting with reg = k, in batches of 8 with the
+// stragglers of each batch finished by VM_run. Checks the results against
+// VM_run alone, and prints the throughput of both in VM steps per second.
+static void run_batch(const Code *code, usize len, usize count, u8 reg) {
+  VM *batched = (VM *)calloc(count, sizeof(VM));
+  u64 steps = 0;
+  u64 lockstep_steps = 0;
+  u64 rounds = 0;
+
+  u64 start = now_ns();
+  for (usize first = 0; first < count; first += 8) {
+    VMBatch b = {0};
+    for (usize i = 0; i < 8; i++) {
+      // Lanes past count start halted
+      b.pc[i] = first + i < count ? 0 : -1;
+      b.regs[reg][i] = (i32)(first + i);
+    }
+
+    rounds += VMBatch_run(&b, code, len);
+
+    for (usize i = 0; i < 8 && first + i < count; i++) {
+      VM *vm = &batched[first + i];
+      vm->pc = b.pc[i];
+      for (usize r = 0; r < 4; r++) {
+        vm->regs[r] = b.regs[r][i];
+      }
+      vm->steps = b.steps[i];
+      lockstep_steps += b.steps[i];
+
+      VM_run(vm, code);
+      steps += vm->steps;
+    }
+  }
+  u64 batch_ns = now_ns() - start;
+
+  start = now_ns();
+  for (usize k = 0; k < count; k++) {
+    VM vm = {0};
+    vm.regs[reg] = (i32)k;
+    VM_run(&vm, code);
+
+    VM *other = &batched[k];
+    if (vm.pc != other->pc || vm.steps != other->steps ||
+        vm.regs[0] != other->regs[0] || vm.regs[1] != other->regs[1] ||
+        vm.regs[2] != other->regs[2] || vm.regs[3] != other->regs[3]) {
+      VM_print(&vm);
+      VM_print(other);
+      panic("Batch result differs\n");
+    }
+  }
+  u64 scalar_ns = now_ns() - start;
+
+  String out = {0};
+  String_push_u64(&out, count, 10);
+  String_push_str(&out, " VMs, ");
+  String_push_u64(&out, steps, 10);
+  String_push_str(&out, " steps, ");
+  String_push_u64(&out, lockstep_steps * 100 / (steps + 1), 10);
+  String_push_str(&out, "% in lockstep, ");
+  String_push_u64(&out, lockstep_steps * 100 / (8 * rounds + 1), 10);
+  String_push_str(&out, "% of lanes busy");
+  String_println(&out);
+  String_clear(&out);
+
+  String_push_str(&out, "Batch: ");
+  String_push_u64(&out, per_second(steps, batch_ns), 10);
+  String_push_str(&out, " steps/s, scalar: ");
+  String_push_u64(&out, per_second(steps, scalar_ns), 10);
+  String_push_str(&out, " steps/s");
+  String_println(&out);
+}
+
+static void push_column(String *out, u64 x, usize width) {
+  u8 buf[32];
+  usize len = fmt_u64(buf, 32, x, 10);
+  for (usize i = len; i < width; i++) {
+    String_push(out, ' ');
+  }
+  String_push_span(out, (Span){.dat = buf, .len = len});
+}
+
+// A backward jnz taken at least once, the loop is [start, end]
+typedef struct {
+  usize start;
+  usize end;
+  u64 steps; // Spent in the loop, nested loops included
+} Loop;
+
+#define HOT_LOOPS 3
+
+// Annotated listing: hits of every instruction, taken / not taken for jnz,
+// and the hottest loops (by steps spent in them) marked #1, #2, ... with the
+// superinstruction they got in code, if any
+static void Profile_print(const Profile *profile, const Program *program,
+                          const Code *code, u64 steps) {
+  Loop hot[HOT_LOOPS] = {0};
+  usize hot_len = 0;
+
+  for (usize pc = 0; pc < program->len; pc++) {
+    Instr instr = program->dat[pc];
+    i64 target = (i64)pc + instr.y.dat.i;
+    if (instr.tag != Jnz || profile->taken[pc] == 0 || target < 0 ||
+        target > (i64)pc) {
+      continue;
+    }
+
+    Loop loop = {.start = (usize)target, .end = pc};
+    for (usize i = loop.start; i <= loop.end; i++) {
+      loop.steps += profile->hits[i];
+    }
+
+    // Insertion into the top HOT_LOOPS
+    usize i = hot_len < HOT_LOOPS ? hot_len++ : HOT_LOOPS;
+    for (; i > 0 && hot[i - 1].steps < loop.steps; i--) {
+      if (i < HOT_LOOPS) {
+        hot[i] = hot[i - 1];
+      }
+    }
+    if (i < HOT_LOOPS) {
+      hot[i] = loop;
+    }
+  }
+
+  String out = {0};
+  String_push_str(&out, "Profile: ");
+  String_push_u64(&out, steps, 10);
+  String_push_str(&out, " steps, ");
+  String_push_u64(&out, profile->cycles, 10);
+  String_push_str(&out, " cycles");
+  String_println(&out);
+  String_clear(&out);
+
+  String_push_str(&out, "  pc       hits      taken  not taken loop");
+  String_println(&out);
+
+  for (usize pc = 0; pc < program->len; pc++) {
+    Instr instr = program->dat[pc];
+    String_clear(&out);
+    push_column(&out, pc, 4);
+    push_column(&out, profile->hits[pc], 11);
+
+    if (instr.tag == Jnz) {
+      push_column(&out, profile->taken[pc], 11);
+      push_column(&out, profile->hits[pc] - profile->taken[pc], 11);
+    } else {
+      String_push_str(&out, "                      ");
+    }
+
+    // Innermost hot loop around this pc
+    usize mark = hot_len;
+    for (usize i = 0; i < hot_len; i++) {
+      if (hot[i].start <= pc && pc <= hot[i].end &&
+          (mark == hot_len ||
+           hot[i].end - hot[i].start < hot[mark].end - hot[mark].start)) {
+        mark = i;
+      }
+    }
+    String_push_str(&out, mark < hot_len ? " #" : "   ");
+    if (mark < hot_len) {
+      String_push(&out, (u8)('1' + mark));
+    }
+    String_push_str(&out, "  ");
+    String_print(&out);
+
+    Instr_print(instr);
+  }
+
+  for (usize i = 0; i < hot_len; i++) {
+    String_clear(&out);
+    String_push(&out, '#');
+    String_push(&out, (u8)('1' + i));
+    String_push_str(&out, ": pc ");
+    String_push_u64(&out, hot[i].start, 10);
+    String_push_str(&out, "..");
+    String_push_u64(&out, hot[i].end, 10);
+    String_push_str(&out, ", ");
+    String_push_u64(&out, profile->taken[hot[i].end], 10);
+    String_push_str(&out, " iterations, ");
+    String_push_u64(&out, hot[i].steps * 100 / (steps + 1), 10);
+    String_push_str(&out, "% of steps, ");
+
+    u8 op = code->dat[hot[i].start].op;
+    String_push_str(&out, op == OP_CLR   ? "fused: clr"
+                          : op == OP_ADD ? "fused: add"
+                          : op == OP_MUL ? "fused: mul"
+                                         : "not fused");
+    String_println(&out);
+  }
+}
+
+typedef enum {
+  RUN_EVAL,     // The reference interpreter
+  RUN_PROFILE,  // Same, printing a profile of each run
+  RUN_THREADED, // The compiled code
+  RUN_JIT,      // Native code, the compiled code when it isn't available
+} Runner;
+
+static Program Program_parse(Span input) {
   SpanSplitIterator line_it = Span_split_lines(input);
 
   Program program = {0};
@@ -186,31 +984,112 @@ static void solve(Span input) {
     line = SpanSplitIterator_next(&line_it);
   }
 
-  {
-    VM vm = {0};
-    VM_eval(&vm, &program);
-    VM_print(&vm);
+  return program;
+}
+
+static void solve(Span input, Runner runner, bool fuse, bool stats) {
+  Program program = Program_parse(input);
+  Code code = Program_compile(&program);
+  if (fuse) {
+    Code_fuse_loops(&code, program.len);
   }
+  JitFn jit = runner == RUN_JIT ? Code_jit(&code) : NULL;
 
-  {
+  for (i32 c = 0; c <= 1; c++) {
     VM vm = {0};
-    vm.regs[2] = 1;
-    VM_eval(&vm, &program);
+    vm.regs[2] = c;
+
+    Profile profile = {0};
+    u64 start = now_ns();
+    if (runner == RUN_EVAL || runner == RUN_PROFILE) {
+      VM_eval(&vm, &program, runner == RUN_PROFILE ? &profile : NULL);
+    } else if (jit && vm.pc == 0) {
+      jit(&vm);
+    } else {
+      VM_run(&vm, &code);
+    }
+    u64 elapsed = now_ns() - start;
+
     VM_print(&vm);
+    if (stats) {
+      String out = {0};
+      String_push_u64(&out, vm.steps, 10);
+      String_push_str(&out, " steps in ");
+      String_push_u64(&out, elapsed / 1000, 10);
+      String_push_str(&out, "us");
+      String_println(&out);
+    }
+    if (runner == RUN_PROFILE) {
+      Profile_print(&profile, &program, &code, vm.steps);
+    }
   }
 }
 
+// `day12 [file] [batch [count]] [--eval|--profile|--jit] [--no-fuse] [--stats]
+//   [--reg <r>]`: --eval runs the reference interpreter instead of the
+// compiled code, --profile the same with an annotated listing of what ran,
+// --jit native code, --no-fuse keeps loops as they are in the compiled code,
+// --stats prints the steps and time of each run.
+// batch runs count VMs (64 by default), VM k starting with k in register
+// --reg (c by default), 8 at a time with AVX2. Loops are never fused there:
+// batches run superinstructions as their fallback, and the scalar baseline has
+// to run the same code.
 int main(void) {
+  const char *modes[] = {"batch"};
+  const CliFlag flags[] = {
+      {.name = "--eval", .value = false},
+      {.name = "--profile", .value = false},
+      {.name = "--jit", .value = false},
+      {.name = "--no-fuse", .value = false},
+      {.name = "--stats", .value = false},
+      {.name = "--reg", .value = true},
+  };
+  Cli cli = Cli_parse(modes, 1, flags, 6);
+
+  Runner runner = Cli_flag(&cli, "--eval")      ? RUN_EVAL
+                  : Cli_flag(&cli, "--profile") ? RUN_PROFILE
+                  : Cli_flag(&cli, "--jit")     ? RUN_JIT
+                                                : RUN_THREADED;
+  bool fuse = !Cli_flag(&cli, "--no-fuse");
+  bool stats = Cli_flag(&cli, "--stats");
+
+  if (cli.mode != NULL) {
+    assert(cli.mode_args_len <= 1);
+    usize count = 64;
+    if (cli.mode_args_len == 1) {
+      count = UNWRAP(Span_parse_u64(Span_from_str(cli.mode_args[0]), 10)).fst;
+    }
+
+    u8 reg = 2;
+    const char *reg_arg = Cli_value(&cli, "--reg");
+    if (reg_arg != NULL) {
+      Span r = Span_from_str(reg_arg);
+      reg = IntOrReg_parse(r).dat.r;
+      assert(IntOrReg_parse(r).tag == Reg);
+    }
+
+    const char *path = cli.path != NULL ? cli.path : "inputs/day12.txt";
+    Program program = Program_parse(Span_from_file(path));
+    Code code = Program_compile(&program);
+    run_batch(&code, program.len, count, reg);
+    return 0;
+  }
+
+  if (cli.path != NULL) {
+    solve(Span_from_file(cli.path), runner, fuse, stats);
+    return 0;
+  }
+
   Span example = Span_from_str("cpy 41 a\n"
                                "inc a\n"
                                "inc a\n"
                                "dec a\n"
                                "jnz a 2\n"
                                "dec a\n");
-  solve(example);
+  solve(example, runner, fuse, stats);
 
   Span input = Span_from_file("inputs/day12.txt");
-  solve(input);
+  solve(input, runner, fuse, stats);
 
   return 0;
 }
@@ -1,149 +1,192 @@
 #include "baz.h"
 
+// The maze covers every u16 coordinate, cells pack as `y << 16 | x`
 typedef struct {
   u16 x;
   u16 y;
 } Pos;
 
-static Hash Pos_hash(const Pos *p) {
-  FxHasher hasher = {0};
-  FxHasher_add(&hasher, p->x);
-  FxHasher_add(&hasher, p->y);
-  return hasher;
-}
+#define WITHIN_MOVES 50
+
+static inline u32 Pos_key(Pos p) { return (u32)p.y << 16 | p.x; }
 
-static inline bool Pos_eq(const Pos *a, const Pos *b) {
-  return a->x == b->x && a->y == b->y;
+static inline bool is_wall(u16 seed, u64 x, u64 y) {
+  u64 t = x * x + 3 * x + 2 * x * y + y + y * y + seed;
+  return __builtin_popcountl(t) % 2 == 1;
 }
 
-static inline bool is_wall(u16 seed, Pos p) {
-  u16 x = p.x;
-  u16 y = p.y;
-  u16 t = (u16)(x * x + 3u * x + 2u * x * y + y + y * y + seed);
-  return __builtin_popcount(t) % 2 == 1;
+// One bit per cell, set the first time the cell is looked at (wall or not), so
+// is_wall runs at most once per cell. Every word is an 8x8 block of cells,
+// which keeps the neighbours of a cell mostly in the same cache line. Pages
+// are only touched where the search goes.
+static inline bool Seen_first_open(u64 *seen, u16 seed, u32 x, u32 y) {
+  usize word = (usize)(y >> 3) << 13 | x >> 3;
+  u64 bit = 1ul << ((y & 7) << 3 | (x & 7));
+  if (seen[word] & bit) {
+    return false;
+  }
+
+  seen[word] |= bit;
+  return !is_wall(seed, x, y);
 }
 
+// FIFO of cell keys in a ring buffer, doubling when full
 typedef struct {
-  usize moves;
-  Pos pos;
-  Pos goal;
-} State;
-
-private
-inline void State_print(State s) {
-  String out = {0};
-  String_push_str(&out, "{ .moves = ");
-  String_push_u64(&out, s.moves, 10);
-  String_push_str(&out, ", .pos = { ");
-  String_push_u64(&out, s.pos.x, 10);
-  String_push_str(&out, ", ");
-  String_push_u64(&out, s.pos.y, 10);
-  String_push_str(&out, " }, .goal = { ");
-  String_push_u64(&out, s.goal.x, 10);
-  String_push_str(&out, ", ");
-  String_push_u64(&out, s.goal.y, 10);
-  String_push_str(&out, "}, }\n");
-  String_print(&out);
+  u32 *dat;
+  usize cap; // power of two
+  usize head;
+  usize len;
+} Frontier;
+
+static Frontier Frontier_mk(usize cap) {
+  assert(cap > 0 && (cap & (cap - 1)) == 0);
+  return (Frontier){
+      .dat = (u32 *)calloc(cap, sizeof(u32)),
+      .cap = cap,
+  };
 }
 
-static inline usize State_manahattan(const State *s) {
-  return ABS_DIFF(usize, s->pos.x, s->goal.x) +
-         ABS_DIFF(usize, s->pos.y, s->goal.y);
+static void Frontier_grow(Frontier *f) {
+  u32 *dat = (u32 *)calloc(f->cap * 2, sizeof(u32));
+  for (usize i = 0; i < f->len; i++) {
+    dat[i] = f->dat[(f->head + i) & (f->cap - 1)];
+  }
+
+  free(f->dat);
+  f->dat = dat;
+  f->cap *= 2;
+  f->head = 0;
 }
 
-static int State_cmp(const State *a, const State *b) {
-  int cmp = usize_cmp(&a->moves, &b->moves);
-  if (cmp != 0) {
-    return -cmp;
+static inline void Frontier_push(Frontier *f, u32 key) {
+  if (f->len == f->cap) {
+    Frontier_grow(f);
   }
+  f->dat[(f->head + f->len++) & (f->cap - 1)] = key;
+}
 
-  usize manhattan_a = State_manahattan(a);
-  usize manhattan_b = State_manahattan(b);
-  return -usize_cmp(&manhattan_a, &manhattan_b);
+static inline u32 Frontier_pop(Frontier *f) {
+  assert(f->len > 0);
+  u32 key = f->dat[f->head];
+  f->head = (f->head + 1) & (f->cap - 1);
+  f->len--;
+  return key;
 }
 
-#define STATE_COUNT (1024)
-define_binary_heap(PriorityQueue, State, STATE_COUNT, State_cmp);
-define_hash_map(Cache, Pos, usize, STATE_COUNT, Pos_hash, Pos_eq);
+typedef struct {
+  u64 moves;  // to the goal
+  u64 within; // cells reachable in at most WITHIN_MOVES moves
+} Result;
 
-usize solve(u16 seed, Pos goal) {
-  PriorityQueue *pq = (PriorityQueue *)calloc(1, sizeof(PriorityQueue));
-  Cache *c = (Cache *)calloc(1, sizeof(Cache));
+// BFS one level at a time: the frontier holds exactly one level when a new
+// depth starts, so levels (and the count within WITHIN_MOVES) come from its
+// length and no per cell distance is needed
+static Result solve(u16 seed, Pos goal) {
+  u64 *seen = (u64 *)calloc((usize)1 << 26, sizeof(u64));
+  Frontier frontier = Frontier_mk(4096);
 
   Pos start = {
       .x = 1,
       .y = 1,
   };
-  State initial = {
-      .moves = 0,
-      .pos = start,
-      .goal = goal,
-  };
-
-  PriorityQueue_insert(pq, initial);
-  Cache_insert(c, start, 0);
+  if (!Seen_first_open(seen, seed, start.x, start.y)) {
+    panic("Start is a wall\n");
+  }
+  Frontier_push(&frontier, Pos_key(start));
 
-  while (pq->len > 0) {
-    State current = UNWRAP(PriorityQueue_extract(pq));
+  u32 goal_key = Pos_key(goal);
+  Result result = {
+      .moves = UINT64_MAX,
+  };
 
-    if (current.moves == 50) {
-      putstr("After 50 moves, visited: ");
-      putu64(c->count);
-      putchar('\n');
+  for (u64 depth = 0;
+       frontier.len > 0 &&
+       (result.moves == UINT64_MAX || depth <= WITHIN_MOVES);
+       depth++) {
+    usize level = frontier.len;
+    if (depth <= WITHIN_MOVES) {
+      result.within += level;
     }
 
-    if (Pos_eq(&current.pos, &current.goal)) {
-      free(pq);
-      free(c);
-      return current.moves;
-    }
+    for (usize i = 0; i < level; i++) {
+      u32 key = Frontier_pop(&frontier);
+      if (key == goal_key) {
+        result.moves = depth;
+      }
 
-    for (int dx = -1; dx <= 1; dx++) {
-      if (current.pos.x == 0 && dx == -1) {
-        continue;
+      u32 x = key & UINT16_MAX;
+      u32 y = key >> 16;
+      if (x > 0 && Seen_first_open(seen, seed, x - 1, y)) {
+        Frontier_push(&frontier, key - 1);
+      }
+      if (x < UINT16_MAX && Seen_first_open(seen, seed, x + 1, y)) {
+        Frontier_push(&frontier, key + 1);
       }
-      u16 x = (u16)((int)current.pos.x + dx);
-
-      for (int dy = -1; dy <= 1; dy += 2) {
-        if (current.pos.y == 0 && dy == -1) {
-          continue;
-        }
-        u16 y = dx == 0 ? (u16)((int)current.pos.y + dy) : current.pos.y;
-        Pos next = {
-            .x = x,
-            .y = y,
-        };
-
-        if (!is_wall(seed, next)) {
-          usize *next_moves = Cache_insert_modify(c, next, 0);
-
-          if (*next_moves == 0 || current.moves + 1 < *next_moves) {
-            *next_moves = current.moves + 1;
-            State next_state = {
-                .moves = *next_moves, .pos = next, .goal = current.goal};
-            PriorityQueue_insert(pq, next_state);
-          }
-        }
+      if (y > 0 && Seen_first_open(seen, seed, x, y - 1)) {
+        Frontier_push(&frontier, key - (1u << 16));
+      }
+      if (y < UINT16_MAX && Seen_first_open(seen, seed, x, y + 1)) {
+        Frontier_push(&frontier, key + (1u << 16));
       }
     }
   }
 
-  panic("Unexpected\n");
+  free(seen);
+  free(frontier.dat);
+
+  if (result.moves == UINT64_MAX) {
+    panic("Goal unreachable\n");
+  }
+  return result;
+}
+
+static void print_result(u16 seed, Pos goal) {
+  Result result = solve(seed, goal);
+
+  String out = {0};
+  String_push_str(&out, "After 50 moves, visited: ");
+  String_push_u64(&out, result.within, 10);
+  String_println(&out);
+
+  putu64(result.moves);
+  putchar('\n');
 }
 
+static u16 parse_u16(const char *arg) {
+  u64 x = UNWRAP(Span_parse_u64(Span_from_str(arg), 10)).fst;
+  assert(x <= UINT16_MAX);
+  return (u16)x;
+}
+
+// `day13 [maze <seed> <x> <y>]`: the puzzle input is only a seed, so there is
+// no file
 int main(void) {
+  const char *modes[] = {"maze"};
+  Cli cli = Cli_parse(modes, 1, NULL, 0);
+  if (cli.path != NULL) {
+    panic("Unexpected argument\n");
+  }
+
+  if (cli.mode != NULL) {
+    assert(cli.mode_args_len == 3);
+    Pos goal = {
+        .x = parse_u16(cli.mode_args[1]),
+        .y = parse_u16(cli.mode_args[2]),
+    };
+    print_result(parse_u16(cli.mode_args[0]), goal);
+    return 0;
+  }
+
   Pos example = {
       .x = 7,
       .y = 4,
   };
-  putu64(solve(10, example));
-  putchar('\n');
+  print_result(10, example);
 
   Pos input = {
       .x = 31,
       .y = 39,
   };
-  putu64(solve(1352, input));
-  putchar('\n');
+  print_result(1352, input);
   return 0;
 }
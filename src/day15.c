@@ -82,7 +82,14 @@ void solve(Span input) {
   }
 }
 
+// `day15 [file]`
 int main(void) {
+  Cli cli = Cli_parse(NULL, 0, NULL, 0);
+  if (cli.path != NULL) {
+    solve(Span_from_file(cli.path));
+    return 0;
+  }
+
   Span example = Span_from_str(
       "Disc #1 has 5 positions; at time=0, it is at position 4.\n"
       "Disc #2 has 2 positions; at time=0, it is at position 1.\n");
@@ -104,7 +104,13 @@ void solve(Span input, usize disk_len) {
   String_println(&out);
 }
 
+// `day16`: the puzzle input is only a state, so there is no file
 int main(void) {
+  Cli cli = Cli_parse(NULL, 0, NULL, 0);
+  if (cli.path != NULL) {
+    panic("Unexpected argument\n");
+  }
+
   // Example
   solve(Span_from_str("110010110100"), 12);
   solve(Span_from_str("10000"), 20);
@@ -47,11 +47,15 @@ static void solve(Span input, usize num_rows) {
   putchar('\n');
 }
 
+// `day18 [file]`
 int main(void) {
-  Span example = Span_from_str(".^^.^.^^^^\n");
-  solve(example, 10);
+  Cli cli = Cli_parse(NULL, 0, NULL, 0);
+  if (cli.path == NULL) {
+    Span example = Span_from_str(".^^.^.^^^^\n");
+    solve(example, 10);
+  }
 
-  Span input = Span_from_file("inputs/day18.txt");
+  Span input = Span_from_file(cli.path != NULL ? cli.path : "inputs/day18.txt");
   solve(input, 40);
   solve(input, 400000);
 
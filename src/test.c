@@ -156,10 +156,224 @@ static void test_bit_set(void) {
   assert(BitSet_is_subset(s, t));
 }
 
+static void test_sort(void) {
+  // Sorting network, including padded lengths
+  {
+    u64 xs[8] = {5, 3, 8, 1, 9, 2, 7, 4};
+    sort_small_u64(xs, 8);
+    for (usize i = 1; i < 8; i++) {
+      assert(xs[i - 1] <= xs[i]);
+    }
+
+    u64 ys[3] = {42, 17, 23};
+    sort_small_u64(ys, 3);
+    assert(ys[0] == 17);
+    assert(ys[1] == 23);
+    assert(ys[2] == 42);
+  }
+
+  // Radix sort
+  {
+    Arena scratch = Arena_mk(1024 * 1024);
+
+    u64 xs[1000];
+    u64 x = 1;
+    for (usize i = 0; i < 1000; i++) {
+      x = x * 6364136223846793005u + 1442695040888963407u;
+      xs[i] = i % 3 == 0 ? x : x >> 40; // Mix wide and narrow keys
+    }
+
+    radix_sort_u64(xs, 1000, &scratch);
+    for (usize i = 1; i < 1000; i++) {
+      assert(xs[i - 1] <= xs[i]);
+    }
+    assert(Arena_mark(&scratch) == 0);
+
+    u32 ys[100];
+    for (usize i = 0; i < 100; i++) {
+      ys[i] = (u32)((i * 37) % 100);
+    }
+
+    radix_sort_u32(ys, 100, &scratch);
+    for (usize i = 0; i < 100; i++) {
+      assert(ys[i] == i);
+    }
+  }
+
+  // Top k on packed (count, byte) keys
+  {
+    u64 keys[5] = {
+        top_k_key(1, 'a'), top_k_key(3, 'b'), top_k_key(1, 'c'),
+        top_k_key(3, 'd'), top_k_key(2, 'e'),
+    };
+
+    u64 top[3];
+    usize n = top_k_u64(keys, 5, top, 3);
+    assert(n == 3);
+    assert(top_k_key_byte(top[0]) == 'b');
+    assert(top_k_key_byte(top[1]) == 'd');
+    assert(top_k_key_byte(top[2]) == 'e');
+    assert(top_k_key_count(top[2]) == 2);
+
+    n = top_k_u64(keys, 2, top, 3);
+    assert(n == 2);
+  }
+}
+
+static void test_histogram(void) {
+  // Small input (direct counting)
+  {
+    Histogram h = {0};
+    Span x = Span_from_str("abracadabra");
+    Histogram_count(&h, x.dat, x.len);
+
+    assert(h.dat['a'] == 5);
+    assert(h.dat['b'] == 2);
+    assert(h.dat['z'] == 0);
+    assert(Histogram_argmax(&h, 'a', 'z' + 1) == 'a');
+    assert(Histogram_argmin_nonzero(&h, 'a', 'z' + 1) == 'd'); // c and d tie
+    assert(Histogram_argmax(&h, 'b', 'z' + 1) == 'r');         // b and r tie
+  }
+
+  // Large input (sub-histograms), with a tail that isn't a multiple of 16
+  {
+    u8 buf[4099];
+    for (usize i = 0; i < 4099; i++) {
+      buf[i] = (u8)(i % 7 == 0 ? 'x' : 'a' + i % 3);
+    }
+
+    Histogram h = {0};
+    Histogram_count(&h, buf, 4099);
+
+    u32 total = 0;
+    u32 x_count = 0;
+    for (usize i = 0; i < 4099; i++) {
+      x_count += buf[i] == 'x';
+    }
+    for (usize i = 0; i < 256; i++) {
+      total += h.dat[i];
+    }
+    assert(total == 4099);
+    assert(h.dat['x'] == x_count);
+    assert(Histogram_argmin_nonzero(&h, 0, 256) == 'x');
+  }
+
+  // Empty range
+  {
+    Histogram h = {0};
+    assert(Histogram_argmax(&h, 3, 9) == 8);
+    assert(Histogram_argmin_nonzero(&h, 3, 9) == 3);
+  }
+}
+
+static void test_bit_transpose(void) {
+  u64 m[64] = {0};
+  for (usize r = 0; r < 64; r++) {
+    m[r] = (r * 0x9E3779B97F4A7C15ul) ^ (r << 7);
+  }
+
+  u64 t[64];
+  memcpy(t, m, sizeof(m));
+  bit_transpose64(t);
+
+  for (usize r = 0; r < 64; r++) {
+    for (usize c = 0; c < 64; c++) {
+      assert(((m[r] >> c) & 1) == ((t[c] >> r) & 1));
+    }
+  }
+
+  bit_transpose64(t);
+  assert(memcmp(t, m, sizeof(m)) == 0);
+}
+
+static void test_u128_divmod(void) {
+  u128 big = (u128)0x123456789abcdef0ul << 64 | 0xfedcba9876543210ul;
+  u128 ns[] = {0, 7, UINT64_MAX, big, ~(u128)0};
+  u128 ds[] = {1, 3, (u128)1 << 64, big >> 3, (u128)1 << 127};
+
+  for (usize i = 0; i < 5; i++) {
+    for (usize j = 0; j < 5; j++) {
+      u128 r;
+      u128 q = u128_divmod(ns[i], ds[j], &r);
+      assert(r < ds[j]);
+      assert(q * ds[j] + r == ns[i]);
+    }
+  }
+}
+
+static void test_memchr(void) {
+  u8 buf[100];
+  for (usize i = 0; i < 100; i++) {
+    buf[i] = (u8)('a' + i % 20);
+  }
+  buf[70] = 'X';
+  buf[97] = 'Y';
+
+  assert(memchr(buf, 'X', 100) == &buf[70]); // In a 32 byte block
+  assert(memchr(buf, 'Y', 100) == &buf[97]); // In the tail
+  assert(memchr(buf, 'Y', 97) == NULL);
+  assert(memchr(&buf[1], 'a', 99) == &buf[20]);
+  assert(memchr(buf, 'Z', 100) == NULL);
+  assert(memchr(buf, 'a', 0) == NULL);
+}
+
+static void test_cli(void) {
+  const char *modes[] = {"search", "cat"};
+  const CliFlag flags[] = {
+      {.name = "--stats", .value = false},
+      {.name = "--reg", .value = true},
+  };
+
+  const char *argv1[] = {"day", "in.txt", "search", "a", "b", "--reg", "c"};
+  args = argv1;
+  args_len = 7;
+  Cli cli = Cli_parse(modes, 2, flags, 2);
+  assert(streq(cli.path, "in.txt") && streq(cli.mode, "search"));
+  assert(cli.mode_args_len == 2 && streq(cli.mode_args[1], "b"));
+  assert(streq(Cli_value(&cli, "--reg"), "c"));
+  assert(!Cli_flag(&cli, "--stats"));
+
+  const char *argv2[] = {"day", "cat", "--stats"};
+  args = argv2;
+  args_len = 3;
+  cli = Cli_parse(modes, 2, flags, 2);
+  assert(cli.path == NULL && streq(cli.mode, "cat"));
+  assert(cli.mode_args_len == 0 && Cli_flag(&cli, "--stats"));
+  assert(Cli_value(&cli, "--reg") == NULL);
+
+  const char *argv3[] = {"day", "-"};
+  args = argv3;
+  args_len = 2;
+  cli = Cli_parse(modes, 2, flags, 2);
+  assert(streq(cli.path, "-") && cli.mode == NULL);
+}
+
+static void test_i32x8(void) {
+  i32x8 x = {5, -3, 7, 100, -3, 2, INT32_MAX, 0};
+  assert(i32x8_hmin(x) == -3);
+
+  for (i32 i = 0; i < 8; i++) {
+    i32x8 y = i32x8_splat(10);
+    y[i] = INT32_MIN;
+    assert(i32x8_hmin(y) == INT32_MIN);
+  }
+
+  i32x8 mask = {-1, 0, -1, 0, 0, 0, 0, -1};
+  i32x8 sel = i32x8_select(mask, x, i32x8_splat(1));
+  assert(sel[0] == 5 && sel[1] == 1 && sel[2] == 7 && sel[7] == 0);
+}
+
 int main(void) {
   test_binary_heap();
   test_hash_map();
   test_bit_set();
+  test_sort();
+  test_histogram();
+  test_bit_transpose();
+  test_u128_divmod();
+  test_memchr();
+  test_i32x8();
+  test_cli();
 
   return 0;
 }